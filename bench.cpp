@@ -0,0 +1,259 @@
+/**
+ * @file bench.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Microbenchmarks of the samplers, the factory model and the experiments
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <fstream>
+#include <string>
+#include "experiments.hpp"
+
+using std::cout;
+using std::endl;
+
+volatile double sink; // keeps the measured results alive
+
+/**
+ * @brief Timings of one benchmark, every trial processes the same @p items
+ */
+struct Result
+{
+    std::string name;
+    long items;
+    std::vector<double> seconds;
+
+    double Median() const
+    {
+        std::vector<double> sorted(seconds);
+        std::sort(sorted.begin(), sorted.end());
+        size_t half = sorted.size() / 2;
+        return sorted.size() % 2 ? sorted[half] : (sorted[half - 1] + sorted[half]) / 2;
+    }
+};
+
+int trials = 5;
+bool json = false;
+std::vector<Result> results;
+
+/**
+ * @brief Runs @p body once to warm up caches, pools and frequency, then @p trials times measured
+ *
+ * @param items number of samples, calls or factories processed by one run of @p body
+ */
+template <class Body>
+void Measure(const std::string &name, long items, Body body)
+{
+    Result result;
+    result.name = name;
+    result.items = items;
+    body();
+    for (int i = 0; i < trials; i++)
+    {
+        myclock::time_point start = myclock::now();
+        body();
+        myclock::time_point end = myclock::now();
+        result.seconds.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    std::cerr << name << ": " << items / result.Median() << " /s" << endl;
+    results.push_back(result);
+}
+
+/**
+ * @brief Evaluates the quantile table of @p distribution and draws from it one by one and in batches
+ */
+template <class Distribution>
+void BenchmarkDistribution(const std::string &name, Distribution &distribution, SimulationContext &context)
+{
+    const int SAMPLES = 1 << 20;
+    const int n = SimulationContext::BATCH_SIZE;
+    double *out = context.samples.values[0].data();
+
+    Measure(name + "/quantile", SAMPLES, [&]()
+    {
+        double sum = 0;
+        for (int i = 0; i < SAMPLES; i++)
+            sum += distribution.Quantile((i + 0.5) / SAMPLES);
+        sink = sum;
+    });
+    Measure(name + "/scalar", SAMPLES, [&]()
+    {
+        double sum = 0;
+        for (int i = 0; i < SAMPLES; i++)
+            sum += distribution(context.generator);
+        distribution.FlushCount();
+        sink = sum;
+    });
+    Measure(name + "/batch", SAMPLES, [&]()
+    {
+        for (int i = 0; i < SAMPLES; i += n)
+            distribution.Sample(context.generator, 0, i, 0, out, n);
+        sink = out[0];
+    });
+}
+
+void BenchmarkSamplers()
+{
+    SimulationContext *context = AcquireContext();
+    BenchmarkDistribution("CTwb", context->CTwb, *context);
+    BenchmarkDistribution("CTda", context->CTda, *context);
+    BenchmarkDistribution("CTpc", context->CTpc, *context);
+    BenchmarkDistribution("DDda", context->DDda, *context);
+    BenchmarkDistribution("DDwb", context->DDwb, *context);
+    BenchmarkDistribution("DFda", context->DFda, *context);
+    BenchmarkDistribution("DFwb", context->DFwb, *context);
+    BenchmarkDistribution("STda", context->STda, *context);
+    BenchmarkDistribution("STwb", context->STwb, *context);
+    ReleaseContext(context);
+}
+
+void BenchmarkFactory()
+{
+    const int CALLS = 1 << 18;
+    const int YEAR = 365*24*60*60;
+    SimulationContext *context = AcquireContext();
+    Factory factory(3, YEAR);
+
+    Measure("Factory::SimulateTime", CALLS, [&]()
+    {
+        long sum = 0;
+        for (int i = 0; i < CALLS; i++)
+            sum += factory.SimulateTime(*context);
+        sink = sum;
+    });
+    Measure("Factory::SimulateBatch", CALLS, [&]()
+    {
+        const int n = SimulationContext::BATCH_SIZE;
+        long sum = 0;
+        for (int i = 0; i < CALLS; i += n)
+        {
+            factory.SimulateBatch(*context, 0, i, context->Om, n);
+            sum += context->Om[0];
+        }
+        sink = sum;
+    });
+
+    // kernels only, on the inputs sampled by the last batch
+    const int KERNEL_CALLS = CALLS / SimulationContext::BATCH_SIZE;
+    Measure("ComputeOutputs/runtime-M", CALLS, [&]()
+    {
+        for (int i = 0; i < KERNEL_CALLS; i++)
+            FactoryModel<PaperModel, 0>::ComputeOutputs(context->samples, 3, YEAR, PaperModel::CTOC,
+                                                        context->Om, SimulationContext::BATCH_SIZE);
+        sink = context->Om[0];
+    });
+    Measure("ComputeOutputs/dispatched", CALLS, [&]()
+    {
+        for (int i = 0; i < KERNEL_CALLS; i++)
+            factory.ComputeOutputs(context->samples, PaperModel::CTOC, context->Om, SimulationContext::BATCH_SIZE);
+        sink = context->Om[0];
+    });
+    ReleaseContext(context);
+
+    const int counts[] = {1000, 10000, 100000};
+    for (int count : counts)
+    {
+        std::string suffix = "/" + std::to_string(count);
+        // the one-factory-at-a-time path, GenerateFactories itself always samples in batches
+        Measure("Factory::SimulateTime/loop" + suffix, count, [&]()
+        {
+            SimulationContext *context = AcquireContext();
+            long sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += factory.SimulateTime(*context);
+            ReleaseContext(context);
+            sink = sum;
+        });
+        Measure("GenerateFactories/batched" + suffix, count, [&]()
+        {
+            sink = GenerateFactories(3, count, YEAR, 0, 1);
+        });
+        Measure("GenerateFactories/parallel" + suffix, count, [&]()
+        {
+            sink = GenerateFactories(3, count, YEAR, 0, 0);
+        });
+    }
+
+    // mixed fleet: 1 to 6 machines, started during the year, one to three shifts
+    const int fleetCounts[] = {100000, 1000000};
+    for (int count : fleetCounts)
+    {
+        FactoryFleet fleet;
+        fleet.Reserve(count);
+        for (int i = 0; i < count; i++)
+            fleet.Add(1 + i % 6, (long long)YEAR * (i % 97) / 97, 8 * (1 + i % 3));
+        Measure("FactoryFleet::Simulate/" + std::to_string(count), count, [&]()
+        {
+            sink = fleet.Simulate(YEAR, NULL, 0, REGRESSION, 0);
+        });
+    }
+}
+
+void BenchmarkExperiments()
+{
+    std::ofstream null;
+    std::streambuf *output = cout.rdbuf(null.rdbuf()); // experiments print their results
+    Measure("Expetiment2", 1, Expetiment2);
+    Measure("Expetiment3", 1, Expetiment3);
+    cout.rdbuf(output);
+}
+
+void PrintResults()
+{
+    if (json)
+        cout << "[" << endl;
+    else
+        cout << "benchmark,items,trials,median_s,min_s,max_s,items_per_s" << endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &result = results[i];
+        double median = result.Median();
+        double min = *std::min_element(result.seconds.begin(), result.seconds.end());
+        double max = *std::max_element(result.seconds.begin(), result.seconds.end());
+        if (json)
+            cout << "  {\"benchmark\": \"" << result.name << "\", \"items\": " << result.items
+                 << ", \"trials\": " << result.seconds.size() << ", \"median_s\": " << median
+                 << ", \"min_s\": " << min << ", \"max_s\": " << max
+                 << ", \"items_per_s\": " << result.items / median << "}"
+                 << (i + 1 < results.size() ? "," : "") << endl;
+        else
+            cout << result.name << "," << result.items << "," << result.seconds.size() << "," << median
+                 << "," << min << "," << max << "," << result.items / median << endl;
+    }
+    if (json)
+        cout << "]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    simulationSeed = 1;
+    for (int i = 1 ; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--trials=", 9) == 0)
+        {
+            trials = atoi(argv[i] + 9);
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else
+        {
+            cout << "Usage : ./benchmark [--trials=N] [--json]" << endl;
+            return 1;
+        }
+    }
+    if (trials < 1)
+    {
+        cout << "--trials has to be positive" << endl;
+        return 1;
+    }
+    cout.precision(9);
+
+    BenchmarkSamplers();
+    BenchmarkFactory();
+    BenchmarkExperiments();
+    PrintResults();
+    return 0;
+}
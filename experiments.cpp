@@ -0,0 +1,461 @@
+/**
+ * @file experiments.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Experiments answering the questions of the project
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include "experiments.hpp"
+#include "surrogate.hpp"
+
+using std::cout;
+using std::endl;
+
+// every run of an experiment simulates its own stream of factories
+const uint32_t EXPERIMENT1_STREAM = 1u << 24;
+const uint32_t EXPERIMENT2_STREAM = 2u << 24;
+const uint32_t EXPERIMENT3_STREAM = 3u << 24;
+const uint32_t EXPERIMENT4_STREAM = 4u << 24;
+
+double ciWidth = 0;
+double confidence = 0.95;
+
+/**
+ * @brief Quantile function of Student's t distribution with @p dof degrees of freedom
+ *
+ * Cornish-Fisher expansion around the normal quantile, accurate enough
+ * for confidence intervals from a few replications on.
+ */
+double StudentQuantile(double p, double dof)
+{
+    double z = NormalQuantile(p);
+    double z2 = z * z;
+    return z + z * (z2 + 1) / (4 * dof)
+             + z * ((5 * z2 + 16) * z2 + 3) / (96 * dof * dof)
+             + z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * dof * dof * dof);
+}
+
+double ConfidenceHalfWidth(double sd, long n)
+{
+    double p = 1 - (1 - confidence) / 2;
+    double quantile = n > 1 ? StudentQuantile(p, n - 1) : NormalQuantile(p);
+    return quantile * sd / std::sqrt((double)n);
+}
+
+/**
+ * @brief Tells whether the mean of the replications in @p statistics is precise enough
+ */
+bool PrecisionReached(const RunningStatistics &statistics)
+{
+    if (statistics.Count() < 2)
+        return false;
+    double halfWidth = ConfidenceHalfWidth(std::sqrt(statistics.SampleVariance()), statistics.Count());
+    return 2 * halfWidth <= ciWidth * std::fabs(statistics.Mean());
+}
+
+/**
+ * @brief Prints number of replications and confidence interval of their mean
+ */
+void PrintInterval(const char *name, const RunningStatistics &statistics)
+{
+    double halfWidth = ConfidenceHalfWidth(std::sqrt(statistics.SampleVariance()), statistics.Count());
+    cout << "Replications: " << statistics.Count() << ", " << confidence * 100 << "% interval of " << name << ": ["
+         << statistics.Mean() - halfWidth << ", " << statistics.Mean() + halfWidth << "]" << endl;
+}
+
+/**
+ * @brief Prints median and upper percentiles of production of one factory
+ */
+void PrintQuantiles(const RunningStatistics &statistics)
+{
+    cout << "Om per factory p50: " << statistics.Quantile(0.5) << "\tp95: " << statistics.Quantile(0.95)
+         << "\tp99: " << statistics.Quantile(0.99) << endl;
+}
+
+long experiment1Samples = 21;
+int planningYears = 5;
+long surrogateSamples = 0;
+VarianceReduction varianceReduction = NO_REDUCTION;
+const int NUMBER_OF_ESTIMATED_FACTORIES = 20000; // factories simulated by experiments with variance reduction
+
+/**
+ * @brief Estimates mean production of a factory, doubling the factories until the requested precision is reached
+ *
+ * Every doubling simulates only the new factories, the earlier ones stay in the estimator.
+ */
+OutputEstimate EstimateToPrecision(int size, int time, uint32_t stream, VarianceReduction reduction)
+{
+    double quantile = NormalQuantile(1 - (1 - confidence) / 2);
+    OutputEstimator estimator(size, time, stream, reduction);
+    estimator.Add(NUMBER_OF_ESTIMATED_FACTORIES);
+    while (true)
+    {
+        OutputEstimate estimate = estimator.Estimate();
+        if (ciWidth == 0 || 2 * quantile * estimate.standardError <= ciWidth * estimate.mean)
+            return estimate;
+        estimator.Add(estimate.factories);
+    }
+}
+
+/**
+ * @brief Prints how much the variance reduction saved compared to plain Monte Carlo
+ */
+void PrintReduction(const OutputEstimate &estimate)
+{
+    if (ciWidth > 0)
+    {
+        double halfWidth = NormalQuantile(1 - (1 - confidence) / 2) * estimate.standardError;
+        cout << "Replications: " << estimate.factories << " factories, " << confidence * 100 << "% interval of mean Om: ["
+             << estimate.mean - halfWidth << ", " << estimate.mean + halfWidth << "]" << endl;
+    }
+    cout << "Variance reduction: " << estimate.Reduction() << "x, simulated " << estimate.factories
+         << " factories, plain Monte Carlo would need " << (long)(estimate.factories * estimate.Reduction())
+         << " for the same precision" << endl;
+}
+
+/**
+ * @brief Calculates mean and standart deviation of model and our representation
+ * 
+ */
+void Expetiment1()
+{
+    ScopedTimer timer(EXPERIMENT1);
+    const int NUMBER_OF_TEST_SAMPLES = 21;
+
+    // data from tables
+    double CTDA_VALS []= {2.8346, 2.907, 2.9342, 2.8936, 2.9046, 2.8971, 2.8378,
+                          2.8432, 2.8342,2.9032, 2.9178, 2.8190, 2.8772, 2.8100,
+                          2.9328, 2.8477, 2.8342,2.8146, 2.9055, 2.8418, 2.9181};
+
+    double CTWB_VALS []= {6.1796, 6.3721, 6.1890, 6.3850, 6.2920, 6.2297, 6.2860,
+                          6.1901, 6.2720, 6.1126, 6.3301, 6.1450, 6.3021, 6.2378,
+                          6.2891, 6.3310, 6.3187, 6.1722, 6.1137, 6.2671, 6.1263};
+                          
+    double CTPC_VALS []= {1.0199, 0.9977, 1.0288, 0.9880, 1.0186, 0.9883, 1.0078,
+                          1.0079, 0.9220, 1.0260, 1.0348, 0.9972, 1.0152, 1.020,
+                          0.9973, 1.0256, 1.0200, 1.0450, 1.0123, 1.0150, 1.0190};
+
+    int DDDA_VALS []= {2241, 3190, 2845, 3986, 4097, 3967, 2988,
+                       3990, 4010, 3720, 2899, 2690, 2477, 3320,
+                       3966, 4210, 3277, 3547, 4177, 4091, 2851};
+
+    int DDWB_VALS []= {1599, 1987, 2366, 1822, 1769, 2544, 1479,
+                       2265, 2740, 1608, 1790, 2011, 2390, 2700,
+                       2541, 1922, 2410, 2180, 2419, 2655, 2399};
+
+    int DFDA_VALS []= {1601, 2067, 1339, 1845, 1937, 2080, 2065,
+                       1205, 1580, 1945, 1540, 1766, 2010, 2087,
+                       2019, 1579, 1368, 1392, 1752, 2180, 1611};
+
+    int DFWB_VALS []= {1790, 1544, 1988, 1756, 2147, 2079, 1655,
+                       1742, 1823, 2009, 1990, 2080, 1590, 1630,
+                       1762, 1934, 2076, 1855, 1988, 1628, 2070};
+
+    int STDA_VALS []= {3867, 3099, 5427, 4635, 4906, 3782, 3056,
+                       4932, 5109, 3550, 5742, 5230, 4480, 5020,
+                       5564, 5716, 4288, 4399, 4980, 5927, 3899};
+
+    int STWB_VALS []= {2613, 2561, 1762, 2611, 2701, 1677, 1577,
+                       2430, 2054, 2689, 2090, 2190, 1988, 1420,
+                       1436, 1788, 1867, 2090, 1645, 2654, 2017};
+
+    long TTOTAL_VALS []= {994433, 992858, 979236, 980697, 981625, 980148, 993847,
+                          975787, 975532, 984679, 977745, 979935, 984775, 981757,
+                          993745, 994579, 1002224,999328, 994918, 994747, 1005139};
+
+    long OM_VALS []= {72902, 91956, 92674, 82019, 80998, 92276, 76479,
+                      90772, 78789, 80136, 89995, 75844, 72967, 79716,
+                      81412, 72110, 90693, 70974, 72538, 78620, 92051};
+
+    // statistics of the table and of our model, in the order they are printed
+    const char *names[] = {"CTDA", "CTWB", "CTPC", "DDDA", "DDWB", "DFDA", "DFWB", "STDA", "STWB", "Ttotal", "Om"};
+    const int NUMBER_OF_VALUES = 11;
+    const int OM = 10;
+    RunningStatistics expected[NUMBER_OF_VALUES];
+    RunningStatistics test[NUMBER_OF_VALUES];
+
+    for (int i = 0; i < NUMBER_OF_TEST_SAMPLES; i++)
+    {
+        double row[] = {CTDA_VALS[i], CTWB_VALS[i], CTPC_VALS[i], (double)DDDA_VALS[i], (double)DDWB_VALS[i],
+                        (double)DFDA_VALS[i], (double)DFWB_VALS[i], (double)STDA_VALS[i], (double)STWB_VALS[i],
+                        (double)TTOTAL_VALS[i], (double)OM_VALS[i]};
+        for (int k = 0; k < NUMBER_OF_VALUES; k++)
+            expected[k].Add(row[k]);
+    }
+
+    // generating random values
+    SimulationContext context;
+    RandomEngine &generator = context.generator;
+    generator.Seek(EXPERIMENT1_STREAM, 0, 0);
+    Factory factory;
+    auto replicate = [&]()
+    {
+        int Td = 24*60*60; int M= 3;
+        double row[] = {context.CTda(generator), context.CTwb(generator), context.CTpc(generator),
+                        context.DDda(generator), context.DDwb(generator), context.DFda(generator),
+                        context.DFwb(generator), context.STda(generator), context.STwb(generator),
+                        (double)(long)(( (Td-context.STda(generator))*((86400-context.DDda(generator))/86400) + Td +(Td-context.STwb(generator))*((86400-context.DDwb(generator))/86400)+Td ) * M),
+                        (double)factory.SimulateTime(context)};
+        for (int k = 0; k < NUMBER_OF_VALUES; k++)
+            test[k].Add(row[k]);
+    };
+
+    // with --ci-width, batches are added until the precision of Om mean is reached
+    for (long i = 0; i < experiment1Samples; i++)
+        replicate();
+    while (ciWidth > 0 && !PrecisionReached(test[OM]))
+        for (int i = 0; i < NUMBER_OF_TEST_SAMPLES; i++)
+            replicate();
+
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    cout << "Experiment 1 - validacia modelu:" << endl << endl;
+    for (int k = 0; k < NUMBER_OF_VALUES; k++)
+    {
+        if (k > 0)
+            cout << endl;
+        cout << "Expected " << names[k] << " mean: " << expected[k].Mean() << "\tour: " << test[k].Mean()
+             << "\tdiff: " << std::fabs(expected[k].Mean() - test[k].Mean()) << endl;
+        cout << "Expected " << names[k] << " sd  : " << expected[k].StandardDeviation() << "\tour: " << test[k].StandardDeviation()
+             << "\tdiff: " << std::fabs(expected[k].StandardDeviation() - test[k].StandardDeviation()) << endl;
+    }
+    PrintQuantiles(test[OM]);
+    if (ciWidth > 0)
+        PrintInterval("Om mean", test[OM]);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+
+/**
+ * @brief Calculates number of factories needed to manufacture 1.14 trilion semiconductors
+ * 
+ */
+void Expetiment2()
+{
+    ScopedTimer timer(EXPERIMENT2);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    cout << "Experiment 2 - kolko modelovych fabrik je treba na to aby zabezpecili vyrobu za rok 2021:" << endl << endl;
+    #define TOTAL_2021 1140000000000 // 1.14 trilion semiconductors manufactured during year 2021
+    const int numberOfRuns = 10;
+    RunningStatistics factories; // needed factories of the runs
+    RunningStatistics output;    // production of every simulated factory
+
+    if (surrogateSamples > 0)
+    {
+        // one simulated distribution of a factory answers any fleet, the runs below stay as its validation
+        OutputSurrogate surrogate;
+        surrogate.Build(3, 365*24*60*60, surrogateSamples, EXPERIMENT2_STREAM);
+        double needed = surrogate.FactoriesNeeded(TOTAL_2021);
+        double error = NormalQuantile(1 - (1 - confidence) / 2) * TOTAL_2021 * surrogate.StandardDeviation()
+                     / (surrogate.Mean() * surrogate.Mean() * std::sqrt((double)surrogate.Samples()));
+        cout << "1.14 trilion polovodicov vyrobi " << needed << " (+-" << error << ") modelovych fabrik za rok." << endl;
+        cout << "S pravdepodobnostou " << confidence * 100 << "% ich vyrobi " << surrogate.FleetSize(TOTAL_2021, confidence)
+             << " modelovych fabrik." << endl;
+        cout << "Om per factory mean: " << surrogate.Mean() << "\tsd: " << surrogate.StandardDeviation()
+             << "\tskewness: " << surrogate.Skewness() << " (" << surrogate.Samples() << " factories)" << endl;
+        cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+        return;
+    }
+
+    if (varianceReduction != NO_REDUCTION)
+    {
+        OutputEstimate estimate = EstimateToPrecision(3, 365*24*60*60, EXPERIMENT2_STREAM, varianceReduction);
+        long factoriesCount = (long)(TOTAL_2021 / estimate.mean) + 1;
+        double error = NormalQuantile(1 - (1 - confidence) / 2) * TOTAL_2021 * estimate.standardError / (estimate.mean * estimate.mean);
+        cout << "1.14 trilion polovodicov vyrobi "<< factoriesCount << " (+-" << error << ") modelovych fabrik za rok." << endl;
+        PrintQuantiles(estimate.output);
+        PrintReduction(estimate);
+        cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+        return;
+    }
+
+    // average of 10 runs, with --ci-width batches of 10 runs are added until the precision is reached
+    do
+    {
+        for (int i = 0; i < numberOfRuns; i++)
+        {
+            uint32_t stream = EXPERIMENT2_STREAM + factories.Count();
+            factories.Add(FactoriesNeeded(3, 365*24*60*60, TOTAL_2021, stream, NULL, &output)); // one year
+        }
+    } while (ciWidth > 0 && !PrecisionReached(factories));
+    if (ciWidth > 0)
+        PrintInterval("factories count", factories);
+    long averageFactoriesCount = factories.Mean();
+
+    cout << "1.14 trilion polovodicov vyrobi "<< averageFactoriesCount << " modelovych fabrik za rok." << endl;
+    PrintQuantiles(output);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+
+/**
+ * @brief Calculates number of factories to be built every year to satisfy the production
+ *
+ * Every run plans a fleet over planningYears: factories built in earlier
+ * years keep producing, so a year builds only what the fleet lacks to
+ * follow the demand rising by 6.25 %.
+ */
+bool Expetiment3()
+{
+    ScopedTimer timer(EXPERIMENT3);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    cout << "Experiment 3 - kolko je treba vybudovat modelovych fabrik rocne aby to stacilo prirodzenemu rastu vyroby (6.25%):" << endl << endl;
+    #define TOTAL_2021 1140000000000 // 1.14 trilion semiconductors manufactured during year 2021
+    const int numberOfRuns = 10;
+    const int YEAR = 365*60*60*24;
+    long totalByNYears = TOTAL_2021; 
+
+    if (varianceReduction != NO_REDUCTION)
+    {
+        // factories are the same every year, one estimate serves all of them
+        OutputEstimate estimate = EstimateToPrecision(3, YEAR, EXPERIMENT3_STREAM, varianceReduction);
+        for(int year = 1 ; year <= planningYears ; year++)
+        {
+            long rise = (totalByNYears / 100) * 6.25;
+            long factoriesCount = (long)(rise / estimate.mean) + 1;
+            double error = NormalQuantile(1 - (1 - confidence) / 2) * rise * estimate.standardError / (estimate.mean * estimate.mean);
+            cout << "po "<< year <<" rokoch, pocet fabrik potrebny vybudovat aby sa stihala vyroba:"<< factoriesCount << " (+-" << error << ")" << endl;
+            totalByNYears = totalByNYears + (long)(factoriesCount * estimate.mean);
+        }
+        PrintQuantiles(estimate.output);
+        PrintReduction(estimate);
+        cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+        return true;
+    }
+
+    RunningStatistics output; // production of every built factory
+    std::vector<RunningStatistics> factories(planningYears); // factories built in the year by the runs
+    std::vector<RunningStatistics> fleets(planningYears);    // size of the fleet at the end of the year
+    do // runs of 10, with --ci-width runs are added until every year reaches the precision
+    {
+        for (int i = 0; i < numberOfRuns; i++)
+        {
+            uint32_t stream = EXPERIMENT3_STREAM + (1 << 16) + factories[0].Count();
+            CapacityPlanner planner(3, YEAR, stream, TOTAL_2021);
+            long long demand = TOTAL_2021;
+            for (int year = 0; year < planningYears; year++)
+            {
+                demand += (long long)((demand / 100) * 6.25);
+                int built = planner.Plan(demand, &output);
+                if (built < 0)
+                {
+                    cout << "po " << year + 1 << " rokoch by bolo treba viac ako " << MAX_NEEDED_FACTORIES
+                         << " fabrik, planovanie zlyhalo" << endl;
+                    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+                    return false;
+                }
+                factories[year].Add(built);
+                fleets[year].Add(planner.Fleet().Size());
+            }
+        }
+    } while (ciWidth > 0 && !std::all_of(factories.begin(), factories.end(), PrecisionReached));
+
+    for (int year = 0; year < planningYears; year++)
+    {
+        if (ciWidth > 0)
+            PrintInterval("factories count", factories[year]);
+        long averageFactoriesCount = factories[year].Mean();
+        cout << "po "<< year + 1 <<" rokoch, pocet fabrik potrebny vybudovat aby sa stihala vyroba:"<< averageFactoriesCount
+             << " (flotila: " << (long)fleets[year].Mean() << ")" << endl;
+    }
+    PrintQuantiles(output);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    return true;
+}
+
+
+/**
+ * @brief Checks the discrete-event simulation on a line whose production is known exactly
+ *
+ * Without breakdowns and setups and with fixed cycle times, the M machines
+ * of every station work in lockstep and the die attach never waits, so the
+ * k-th group of M batches leaves pre-cap at sum(p) + (k - 1) * max(p), p
+ * being the times of one batch on the stations. Every factory then has to
+ * make Q * M * K pieces, K the number of groups done by Td. Checked for
+ * each batch size of the paper, the model parameters are restored after.
+ *
+ * @return false when a factory makes anything else
+ */
+bool ValidateDeterministicLine(int M, int Td, uint32_t stream)
+{
+    const int NUMBER_OF_FACTORIES = 100;
+    const double WIDTH = 1e-9; // of the input windows, far below anything changing the count
+    const ModelParameters original = modelParameters;
+    ModelParameters line = original;
+    const double CTda = 2.8766, CTwb = 6.2756, CTpc = 1.019; // centers of the regression terms
+    line.CTda = {CTda, CTda + WIDTH};
+    line.CTwb = {CTwb, CTwb + WIDTH};
+    line.CTpc = {CTpc, CTpc + WIDTH};
+    line.STda = line.STwb = {0, WIDTH};
+    line.DFda = line.DFwb = {1e9, 2e9}; // minutes, the first breakdown comes after Td
+    bool valid = true;
+    std::vector<long> outputs(NUMBER_OF_FACTORIES);
+    for (int b = 0; b < 3; b++)
+    {
+        int Q = PaperModel::BATCH_SIZES[b];
+        line.Q[0] = line.Q[1] = line.Q[2] = Q;
+        SetModelParameters(line);
+        SimulateFactories(M, NUMBER_OF_FACTORIES, Td, outputs.data(), stream, 0, DISCRETE_EVENT);
+
+        double p[] = {Q * CTda, (double)line.CToc, Q * CTwb, Q * CTpc};
+        double sum = p[0] + p[1] + p[2] + p[3], slowest = *std::max_element(p, p + 4);
+        long groups = Td < sum ? 0 : (long)((Td - sum) / slowest) + 1;
+        long expected = (long)Q * M * groups;
+        int wrong = 0;
+        for (int i = 0; i < NUMBER_OF_FACTORIES; i++)
+            wrong += outputs[i] != expected;
+        cout << "Deterministic line Q=" << Q << ": expected " << expected << ", " << wrong << " of "
+             << NUMBER_OF_FACTORIES << " factories differ" << (wrong ? "\tFAILED" : "\tOK") << endl;
+        valid = valid && wrong == 0;
+    }
+    SetModelParameters(original);
+    return valid;
+}
+
+/**
+ * @brief Compares discrete-event simulation of the line with the regression formula
+ *
+ * Both methods simulate the same factories with the same random inputs.
+ */
+bool Expetiment4()
+{
+    ScopedTimer timer(EXPERIMENT4);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    cout << "Experiment 4 - validacia simulacie diskretnych udalosti voci regresnemu modelu:" << endl << endl;
+    const int NUMBER_OF_FACTORIES = 2000;
+    const int YEAR = 365*24*60*60;
+    std::vector<long> regression(NUMBER_OF_FACTORIES);
+    std::vector<long> events(NUMBER_OF_FACTORIES);
+
+    myclock::time_point start = myclock::now();
+    SimulateFactories(3, NUMBER_OF_FACTORIES, YEAR, regression.data(), EXPERIMENT4_STREAM, 0, REGRESSION);
+    myclock::time_point middle = myclock::now();
+    SimulateFactories(3, NUMBER_OF_FACTORIES, YEAR, events.data(), EXPERIMENT4_STREAM, 0, DISCRETE_EVENT);
+    myclock::time_point end = myclock::now();
+
+    RunningStatistics regressionStatistics;
+    RunningStatistics eventsStatistics;
+    for (int i = 0; i < NUMBER_OF_FACTORIES; i++)
+    {
+        regressionStatistics.Add(regression[i]);
+        eventsStatistics.Add(events[i]);
+    }
+    double regression_mean = regressionStatistics.Mean();
+    double events_mean = eventsStatistics.Mean();
+    double regression_sd = regressionStatistics.StandardDeviation();
+    double events_sd = eventsStatistics.StandardDeviation();
+
+    double regression_seconds = std::chrono::duration<double>(middle - start).count();
+    double events_seconds = std::chrono::duration<double>(end - middle).count();
+
+    cout << "Regression Om mean: " << regression_mean << "\tsd: " << regression_sd << "\tfactories/s: " << NUMBER_OF_FACTORIES / regression_seconds << endl;
+    cout << "Events Om mean    : " << events_mean << "\tsd: " << events_sd << "\tfactories/s: " << NUMBER_OF_FACTORIES / events_seconds << endl;
+    cout << "Events / regression: " << events_mean / regression_mean << " (different models, see README)" << endl;
+    cout << "Regression ";
+    PrintQuantiles(regressionStatistics);
+    cout << "Events ";
+    PrintQuantiles(eventsStatistics);
+    bool valid = ValidateDeterministicLine(3, YEAR, EXPERIMENT4_STREAM);
+    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    return valid;
+}
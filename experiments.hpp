@@ -0,0 +1,49 @@
+/**
+ * @file experiments.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Experiments answering the questions of the project
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef EXPERIMENTS_HPP
+#define EXPERIMENTS_HPP
+
+#include "simulation.hpp"
+
+extern double ciWidth;          // requested width of confidence intervals relative to the mean, 0 for fixed replications
+extern double confidence;       // confidence level of the intervals
+extern long experiment1Samples; // replications of Experiment 1, set by --samples
+extern int planningYears;       // years planned by Experiment 3, set by --years
+extern long surrogateSamples;   // factories of the surrogate answering Experiment 2, 0 to simulate the fleets
+extern VarianceReduction varianceReduction; // estimator of experiments 2 and 3, set by --vr
+
+const int MAX_PLANNING_YEARS = 60; // start of the factories built in the last year still fits in int seconds
+const long MAX_SURROGATE_SAMPLES = 1L << 26; // factories of --surrogate, their outputs are kept in memory
+
+/**
+ * @brief Half width of the confidence interval of a mean of @p n samples with standard deviation @p sd
+ */
+double ConfidenceHalfWidth(double sd, long n);
+
+/**
+ * @brief Prints median and upper percentiles of production of one factory
+ */
+void PrintQuantiles(const RunningStatistics &statistics);
+
+void Expetiment1();
+void Expetiment2();
+/**
+ * @brief Plans the factories built every year to follow the rising demand
+ *
+ * @return false when a year would need more factories than FactoriesNeeded can find
+ */
+bool Expetiment3();
+/**
+ * @brief Compares the discrete-event simulation with the regression formula and validates it on a deterministic line
+ *
+ * @return false when the deterministic line does not make its exact production
+ */
+bool Expetiment4();
+
+#endif // EXPERIMENTS_HPP
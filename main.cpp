@@ -0,0 +1,302 @@
+/**
+ * @file main.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Command line interface running the experiments
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include "experiments.hpp"
+#include "sweep.hpp"
+#include "shard.hpp"
+#include "sensitivity.hpp"
+#include "server.hpp"
+#include "timeline.hpp"
+
+using std::cout;
+using std::endl;
+
+/**
+ * @brief Simulates @p count factories working for a year and prints their production
+ *
+ * @param coordinator if not NULL, the factories are simulated by its worker processes
+ */
+bool Generate(int count, Coordinator *coordinator)
+{
+    const uint32_t GENERATE_STREAM = 6u << 24;
+    ShardJob job = {ModelParameters(), 3, 365*24*60*60, GENERATE_STREAM, count, REGRESSION};
+    ShardResult result;
+    if (!coordinator)
+        SimulateShard(job, 0, count, result);
+    else if (!coordinator->Run(job, result))
+        return false;
+    const RunningStatistics &statistics = result.statistics;
+    cout << "Factories: " << count << "\tproduction: " << result.total << endl;
+    cout << "Om mean: " << statistics.Mean() << "\tsd: " << statistics.StandardDeviation() << endl;
+    PrintQuantiles(statistics);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+
+    bool one = false;
+    bool two = false;
+    bool three = false;
+    bool four = false;
+    bool seeded = false;
+    const char *metrics = NULL; // file written by --metrics
+    const char *sweep = NULL;   // scenario file of --sweep
+    const char *output = NULL;  // result file of --sweep or --timeline
+    bool binary = false;
+    long generate = 0;          // factories of --generate
+    long timeline = 0;          // factories of --timeline
+    int period = 24*60*60;      // period of --timeline [seconds]
+    int machines = 3;           // M of --timeline
+    bool years = false;         // --years given, it is also the horizon of --timeline
+    const char *scan = NULL;    // timeline file of --scan
+    long sensitivity = 0;       // base points of --sensitivity
+    bool surrogate = false;     // --surrogate given, its factories are in surrogateSamples
+    const char *serve = NULL;   // socket of --serve
+    bool worker = false;
+    int processes = 0;          // worker processes of the coordinator, 0 runs everything in this one
+    int shardSize = 0;
+    int shardTimeout = SHARD_TIMEOUT;
+    long threads = 0;           // threads of --threads, 0 is one per core
+    std::string workerCommand;
+    myclock::time_point start = myclock::now();
+    for (int i = 1 ; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            simulationSeed = strtoull(argv[i] + 7, NULL, 10);
+            seeded = true;
+        }
+        else if (strncmp(argv[i], "--ci-width=", 11) == 0)
+        {
+            ciWidth = atof(argv[i] + 11);
+        }
+        else if (strncmp(argv[i], "--confidence=", 13) == 0)
+        {
+            confidence = atof(argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--metrics=", 10) == 0)
+        {
+            metrics = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--sweep=", 8) == 0)
+        {
+            sweep = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--output=", 9) == 0)
+        {
+            output = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--binary") == 0)
+        {
+            binary = true;
+        }
+        else if (strncmp(argv[i], "--timeline=", 11) == 0)
+        {
+            timeline = atol(argv[i] + 11);
+        }
+        else if (strncmp(argv[i], "--period=", 9) == 0)
+        {
+            period = atoi(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--machines=", 11) == 0)
+        {
+            machines = atoi(argv[i] + 11);
+        }
+        else if (strncmp(argv[i], "--scan=", 7) == 0)
+        {
+            scan = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--generate=", 11) == 0)
+        {
+            generate = atol(argv[i] + 11);
+        }
+        else if (strcmp(argv[i], "--worker") == 0)
+        {
+            worker = true;
+        }
+        else if (strncmp(argv[i], "--processes=", 12) == 0)
+        {
+            processes = atoi(argv[i] + 12);
+        }
+        else if (strncmp(argv[i], "--shard-size=", 13) == 0)
+        {
+            shardSize = atoi(argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--shard-timeout=", 16) == 0)
+        {
+            shardTimeout = atoi(argv[i] + 16);
+        }
+        else if (strncmp(argv[i], "--worker-command=", 17) == 0)
+        {
+            workerCommand = argv[i] + 17;
+        }
+        else if (strncmp(argv[i], "--serve=", 8) == 0)
+        {
+            serve = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--sensitivity=", 14) == 0)
+        {
+            sensitivity = atol(argv[i] + 14);
+        }
+        else if (strncmp(argv[i], "--surrogate=", 12) == 0)
+        {
+            surrogateSamples = atol(argv[i] + 12);
+            surrogate = true;
+        }
+        else if (strncmp(argv[i], "--years=", 8) == 0)
+        {
+            planningYears = atoi(argv[i] + 8);
+            years = true;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            char *end;
+            threads = strtol(argv[i] + 10, &end, 10);
+            if (end == argv[i] + 10 || *end)
+                threads = -1;
+        }
+        else if (strncmp(argv[i], "--samples=", 10) == 0)
+        {
+            experiment1Samples = atol(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--vr=antithetic") == 0)
+        {
+            varianceReduction = ANTITHETIC;
+        }
+        else if (strcmp(argv[i], "--vr=control") == 0)
+        {
+            varianceReduction = CONTROL_VARIATES;
+        }
+        else if (strcmp(argv[i], "-1") == 0)
+        {
+            one = true;
+        }
+        else if (strcmp(argv[i], "-2") == 0)
+        {
+            two = true;
+        }
+        else if (strcmp(argv[i], "-3") == 0)
+        {
+            three = true;
+        }
+        else if (strcmp(argv[i], "-4") == 0)
+        {
+            four = true;
+        }
+        else
+        {
+            cout << "Usage : ./simualtion [-1] [-2] [-3] [-4] [--seed=N] [--vr=antithetic|control] [--ci-width=W] [--confidence=C] [--samples=N] [--years=N] [--surrogate=N] [--threads=N] [--metrics=file.json]" << endl;
+            cout << "        ./simulation --sweep=scenarios.ini [--output=FILE] [--binary] [--seed=N] [--metrics=file.json]" << endl;
+            cout << "        ./simulation --generate=COUNT [--seed=N] [--metrics=file.json]" << endl;
+            cout << "        ./simulation --timeline=COUNT --output=FILE [--period=SECONDS] [--years=N] [--machines=M] [--seed=N] [--threads=N]" << endl;
+            cout << "        ./simulation --scan=FILE" << endl;
+            cout << "        ./simulation --sensitivity=POINTS [--threads=N] [--metrics=file.json]" << endl;
+            cout << "        ./simulation --serve=SOCKET [--seed=N] [--threads=N]" << endl;
+            cout << "        sweep and generate accept [--processes=N] [--shard-size=N] [--shard-timeout=S] [--worker-command=CMD]" << endl;
+            return 1;
+        }
+    }
+    if (ciWidth < 0 || confidence <= 0 || confidence >= 1)
+    {
+        cout << "--ci-width has to be positive and --confidence between 0 and 1" << endl;
+        return 1;
+    }
+    if (experiment1Samples < 1)
+    {
+        cout << "--samples has to be positive" << endl;
+        return 1;
+    }
+    if (planningYears < 1 || planningYears > MAX_PLANNING_YEARS)
+    {
+        cout << "--years has to be between 1 and " << MAX_PLANNING_YEARS << endl;
+        return 1;
+    }
+    if (threads < 0 || threads > (long)MAX_WORKER_THREADS)
+    {
+        cout << "--threads has to be a number between 0 and " << MAX_WORKER_THREADS << ", 0 uses every core" << endl;
+        return 1;
+    }
+    workerThreads = threads;
+    if (surrogate && (surrogateSamples < 1 || surrogateSamples > MAX_SURROGATE_SAMPLES))
+    {
+        cout << "--surrogate has to be between 1 and " << MAX_SURROGATE_SAMPLES << endl;
+        return 1;
+    }
+    // --scan only reads a file, every other mode simulates
+    bool scanOnly = scan && !one && !two && !three && !four && !sweep && !generate && !sensitivity && !timeline && !serve;
+    if (!seeded && !scanOnly)
+    {
+        simulationSeed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+        std::cerr << "Seed: " << simulationSeed << " (use --seed=" << simulationSeed << " to repeat this run)" << endl;
+    }
+    if (worker)
+        return RunWorker();
+    if ((output && !sweep && !timeline) || (binary && !sweep))
+    {
+        cout << "--output needs --sweep or --timeline, --binary needs --sweep" << endl;
+        return 1;
+    }
+    int horizon = (years ? planningYears : 1) * TIMELINE_TIME; // Td of --timeline
+    if (timeline < 0 || timeline > INT32_MAX || (timeline && !output) || period < MIN_TIMELINE_PERIOD
+        || period > horizon || machines < 1 || machines > MAX_MACHINES)
+    {
+        cout << "--timeline has to be positive and needs --output, --period has to be between "
+             << MIN_TIMELINE_PERIOD << " and " << horizon << ", --machines between 1 and " << MAX_MACHINES << endl;
+        return 1;
+    }
+    if (sensitivity < 0 || sensitivity > MAX_SENSITIVITY_SAMPLES)
+    {
+        cout << "--sensitivity has to be between 1 and " << MAX_SENSITIVITY_SAMPLES << endl;
+        return 1;
+    }
+    if (generate < 0 || generate > INT32_MAX || shardSize < 0)
+    {
+        cout << "--generate and --shard-size have to be positive" << endl;
+        return 1;
+    }
+    if (processes < 0 || processes > (int)MAX_PROCESSES || shardTimeout < 1)
+    {
+        cout << "--processes has to be between 0 and " << MAX_PROCESSES << " and --shard-timeout positive" << endl;
+        return 1;
+    }
+    if (serve)
+    {
+        QueryServer server(SERVER_CONNECTIONS, SERVER_CACHE_SIZE);
+        return server.Run(serve) ? 0 : 1;
+    }
+    std::unique_ptr<Coordinator> coordinator;
+    if (processes > 0)
+        coordinator.reset(new Coordinator(processes, shardSize, workerCommand, shardTimeout));
+    bool all = !one && !two && !three && !four && !sweep && !generate && !sensitivity && !timeline && !scan;
+    if (sweep && !RunSweep(sweep, output, binary, coordinator.get()))
+        return 1;
+    if (generate && !Generate(generate, coordinator.get()))
+        return 1;
+    if (timeline && !RunTimeline(timeline, output, period, machines, horizon))
+        return 1;
+    if (scan && !ScanTimeline(scan))
+        return 1;
+    if (sensitivity)
+        RunSensitivity(sensitivity);
+    if (one || all) Expetiment1();
+    if (two || all) Expetiment2();
+    bool valid = !(three || all) || Expetiment3();
+    valid = (!four || Expetiment4()) && valid;
+
+    if (metrics)
+    {
+        double seconds = std::chrono::duration<double>(myclock::now() - start).count();
+        if (!WriteMetrics(metrics, seconds))
+        {
+            std::cerr << "Cannot write metrics to " << metrics << endl;
+            return 1;
+        }
+    }
+    return valid ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+/**
+ * @file metrics.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Counters and timers of the hot paths, written as JSON by --metrics
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <fstream>
+#include "metrics.hpp"
+
+#ifndef SIMULATION_NO_METRICS
+
+std::atomic<long long> counters[COUNTER_COUNT];
+std::atomic<long long> phaseNanoseconds[PHASE_COUNT];
+std::atomic<long long> phaseCalls[PHASE_COUNT];
+
+const char *COUNTER_NAMES[COUNTER_COUNT] = {
+    "normal_samples", "exponential_samples",
+    "regression_factories", "event_factories", "events",
+    "searches", "search_steps", "search_factories"
+};
+
+const char *PHASE_NAMES[PHASE_COUNT] = {
+    "experiment1", "experiment2", "experiment3", "experiment4",
+    "simulate_factories", "factories_needed", "estimate_mean_output",
+    "sensitivity", "surrogate", "timeline"
+};
+
+bool WriteMetrics(const char *path, double seconds)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+    long long factories = counters[REGRESSION_FACTORIES] + counters[EVENT_FACTORIES];
+
+    file << "{" << std::endl;
+    file << "  \"enabled\": true," << std::endl;
+    file << "  \"seconds\": " << seconds << "," << std::endl;
+    file << "  \"counters\": {" << std::endl;
+    for (int c = 0; c < COUNTER_COUNT; c++)
+        file << "    \"" << COUNTER_NAMES[c] << "\": " << counters[c] << (c + 1 < COUNTER_COUNT ? "," : "") << std::endl;
+    file << "  }," << std::endl;
+    file << "  \"factories_per_second\": " << factories / seconds << "," << std::endl;
+    file << "  \"factories_per_search_step\": "
+         << (counters[SEARCH_STEPS] > 0 ? (double)counters[SEARCH_FACTORIES] / counters[SEARCH_STEPS] : 0) << "," << std::endl;
+    file << "  \"phases\": {" << std::endl;
+    for (int p = 0; p < PHASE_COUNT; p++)
+        file << "    \"" << PHASE_NAMES[p] << "\": {\"calls\": " << phaseCalls[p] << ", \"seconds\": "
+             << phaseNanoseconds[p] * 1e-9 << "}" << (p + 1 < PHASE_COUNT ? "," : "") << std::endl;
+    file << "  }" << std::endl;
+    file << "}" << std::endl;
+    return (bool)file;
+}
+
+#else
+
+bool WriteMetrics(const char *path, double seconds)
+{
+    std::ofstream file(path);
+    file << "{" << std::endl;
+    file << "  \"enabled\": false," << std::endl;
+    file << "  \"seconds\": " << seconds << std::endl;
+    file << "}" << std::endl;
+    return (bool)file;
+}
+
+#endif // SIMULATION_NO_METRICS
@@ -0,0 +1,112 @@
+/**
+ * @file metrics.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Counters and timers of the hot paths, written as JSON by --metrics
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ *
+ * Compiling with -DSIMULATION_NO_METRICS (make METRICS=off) turns Count and
+ * ScopedTimer into empty inline functions, so they cost nothing.
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+
+/**
+ * @brief Events counted during a run
+ */
+enum Counter
+{
+    NORMAL_SAMPLES,         // numbers sampled by NormalDistribution
+    EXPONENTIAL_SAMPLES,    // numbers sampled by ExponentialDistribution
+    REGRESSION_FACTORIES,   // factories simulated by the regression formula
+    EVENT_FACTORIES,        // factories simulated event by event
+    EVENTS,                 // events processed by the discrete-event simulation
+    SEARCHES,               // calls of FactoriesNeeded
+    SEARCH_STEPS,           // galloping steps of FactoriesNeeded
+    SEARCH_FACTORIES,       // factories simulated by those steps
+    COUNTER_COUNT
+};
+
+/**
+ * @brief Parts of a run measured by ScopedTimer, nested phases are included in the outer ones
+ */
+enum Phase
+{
+    EXPERIMENT1, EXPERIMENT2, EXPERIMENT3, EXPERIMENT4,
+    SIMULATE_FACTORIES,
+    FACTORIES_NEEDED,
+    ESTIMATE_MEAN_OUTPUT,
+    SENSITIVITY,
+    SURROGATE,
+    TIMELINE,
+    PHASE_COUNT
+};
+
+#ifndef SIMULATION_NO_METRICS
+
+extern std::atomic<long long> counters[COUNTER_COUNT];
+extern std::atomic<long long> phaseNanoseconds[PHASE_COUNT];
+extern std::atomic<long long> phaseCalls[PHASE_COUNT];
+
+/**
+ * @brief Adds @p n to the counter, hot loops count locally and call it once per batch
+ */
+inline void Count(Counter counter, long long n = 1)
+{
+    counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds time from its construction to its destruction to the phase
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Phase phase):
+        phase(phase), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+        phaseNanoseconds[phase].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                                          std::memory_order_relaxed);
+        phaseCalls[phase].fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#else
+
+inline void Count(Counter, long long = 1)
+{
+}
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Phase)
+    {
+    }
+};
+
+#endif // SIMULATION_NO_METRICS
+
+/**
+ * @brief Writes counters, derived rates and phase times as JSON
+ *
+ * @param path file to write
+ * @param seconds wall time of the whole run
+ * @return false when the file cannot be written
+ */
+bool WriteMetrics(const char *path, double seconds);
+
+#endif // METRICS_HPP
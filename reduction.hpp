@@ -0,0 +1,70 @@
+/**
+ * @file reduction.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Overflow-safe and compensated accumulators of the reductions
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <cmath>
+#include <string>
+
+__extension__ typedef __int128 Int128; // exact sums of integer outputs and their squares
+
+/**
+ * @brief Decimal representation of @p value, streams cannot print Int128
+ */
+inline std::string ToString(Int128 value)
+{
+    bool negative = value < 0;
+    std::string digits;
+    do
+    {
+        int digit = (int)(value % 10);
+        digits.insert(digits.begin(), '0' + (negative ? -digit : digit));
+        value /= 10;
+    } while (value != 0);
+    return negative ? "-" + digits : digits;
+}
+
+/**
+ * @brief Sum of doubles with Neumaier's compensation of the rounding errors
+ *
+ * The error of the result does not grow with the number of added values,
+ * so partial sums of blocks can be combined without losing precision.
+ */
+class NeumaierSum
+{
+public:
+    NeumaierSum():
+        sum(0), compensation(0)
+    {
+    }
+
+    void Add(double x)
+    {
+        double t = sum + x;
+        if (std::fabs(sum) >= std::fabs(x))
+            compensation += (sum - t) + x;
+        else
+            compensation += (x - t) + sum;
+        sum = t;
+    }
+
+    void Merge(const NeumaierSum &other)
+    {
+        Add(other.sum);
+        Add(other.compensation);
+    }
+
+    double Value() const { return sum + compensation; }
+
+private:
+    double sum;
+    double compensation; // rounding errors of the additions
+};
+
+#endif // REDUCTION_HPP
@@ -0,0 +1,275 @@
+/**
+ * @file sensitivity.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Quasi-Monte Carlo variance-based sensitivity analysis of the factory model
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include "sensitivity.hpp"
+
+using std::cout;
+using std::endl;
+
+/**
+ * @brief Primitive polynomial and initial direction numbers of one dimension of the Sobol sequence
+ */
+struct DirectionNumbers
+{
+    int degree;
+    uint32_t coefficients; // inner coefficients of the polynomial, highest first
+    uint32_t m[7];
+};
+
+// dimensions 2 .. 30 of new-joe-kuo-6.21201, the first one is the van der Corput sequence
+const DirectionNumbers JOE_KUO[SobolSequence::MAX_DIMENSIONS - 1] = {
+    {1, 0, {1}}, {2, 1, {1, 3}}, {3, 1, {1, 3, 1}}, {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}}, {4, 4, {1, 3, 5, 13}}, {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}}, {5, 7, {1, 1, 7, 11, 19}}, {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}}, {5, 14, {1, 3, 5, 5, 31}}, {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}}, {6, 16, {1, 3, 1, 13, 27, 49}}, {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}}, {6, 25, {1, 1, 5, 5, 19, 61}}, {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}}, {7, 7, {1, 1, 3, 13, 7, 35, 63}}, {7, 8, {1, 3, 5, 9, 1, 25, 53}},
+    {7, 14, {1, 3, 1, 13, 9, 35, 107}}, {7, 19, {1, 3, 1, 5, 27, 61, 31}}, {7, 21, {1, 1, 5, 11, 19, 41, 61}},
+    {7, 28, {1, 3, 5, 3, 3, 13, 69}}, {7, 31, {1, 1, 7, 13, 1, 19, 1}}, {7, 32, {1, 3, 7, 5, 13, 19, 59}},
+    {7, 37, {1, 1, 3, 9, 25, 29, 41}}
+};
+
+SobolSequence::SobolSequence(int dimensions):
+    dimensions(dimensions), directions(dimensions * BITS), state(dimensions), index(0)
+{
+    for (int j = 0; j < BITS; j++)
+        directions[j] = 1u << (BITS - 1 - j);
+    for (int d = 1; d < dimensions; d++)
+    {
+        const DirectionNumbers &numbers = JOE_KUO[d - 1];
+        int s = numbers.degree;
+        uint32_t *v = &directions[d * BITS];
+        for (int j = 0; j < s; j++)
+            v[j] = numbers.m[j] << (BITS - 1 - j);
+        for (int j = s; j < BITS; j++)
+        {
+            v[j] = v[j - s] ^ (v[j - s] >> s);
+            for (int k = 1; k < s; k++)
+                if ((numbers.coefficients >> (s - 1 - k)) & 1)
+                    v[j] ^= v[j - k];
+        }
+    }
+}
+
+void SobolSequence::Seek(uint32_t index)
+{
+    this->index = index;
+    uint32_t gray = index ^ (index >> 1);
+    for (int d = 0; d < dimensions; d++)
+    {
+        state[d] = 0;
+        for (int j = 0; j < BITS; j++)
+            if ((gray >> j) & 1)
+                state[d] ^= directions[d * BITS + j];
+    }
+}
+
+void SobolSequence::Next(double *point)
+{
+    for (int d = 0; d < dimensions; d++)
+        point[d] = std::ldexp((double)state[d], -BITS);
+    index++;
+    int bit = 0; // Gray codes of index - 1 and index differ in the lowest set bit of index
+    while (bit < BITS - 1 && !((index >> bit) & 1))
+        bit++;
+    for (int d = 0; d < dimensions; d++)
+        state[d] ^= directions[d * BITS + bit];
+}
+
+const int K = PARAMETER_COUNT + 1; // uniform inputs of a factory, every parameter and the Batch size
+const int G = SensitivityIndices::FACTOR_COUNT;
+
+// factor every uniform input belongs to, in the order of Parameter
+const int FACTOR_OF[K] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 7, 3, 8, 4, 9};
+
+const char *FactorName(int f)
+{
+    static const char *names[G] = {"CTwb", "CTda", "CTpc", "DDda", "DDwb", "DFda", "DFwb", "STda", "STwb", "Q"};
+    return names[f];
+}
+
+/**
+ * @brief Input @p parameter of a factory whose uniform number is @p u
+ */
+double InputQuantile(const SimulationContext &context, int parameter, double u)
+{
+    switch (parameter)
+    {
+    case CTWB: return context.CTwb.Quantile(u);
+    case CTDA: return context.CTda.Quantile(u);
+    case CTPC: return context.CTpc.Quantile(u);
+    case DDDA: case TT_DDDA: return context.DDda.Quantile(u);
+    case DDWB: case TT_DDWB: return context.DDwb.Quantile(u);
+    case DFDA: return context.DFda.Quantile(u);
+    case DFWB: return context.DFwb.Quantile(u);
+    case STDA: case TT_STDA: return context.STda.Quantile(u);
+    case STWB: case TT_STWB: return context.STwb.Quantile(u);
+    default: return context.parameters.Q[std::min((int)(3 * u), 2)];
+    }
+}
+
+/**
+ * @brief Writes inputs of factory @p row of @p samples from uniform numbers @p u
+ */
+void SetInputs(const SimulationContext &context, const double *u, FactorySamples &samples, int row)
+{
+    for (int p = 0; p < PARAMETER_COUNT; p++)
+        samples.values[p][row] = InputQuantile(context, p, u[p]);
+    samples.Q[row] = InputQuantile(context, BATCH_SIZE_INDEX, u[BATCH_SIZE_INDEX]);
+}
+
+void EstimateSensitivity(int M, int Td, long samples, std::vector<SensitivityIndices> &checkpoints,
+                         unsigned threads)
+{
+    ScopedTimer timer(SENSITIVITY);
+    const int BLOCK = 256;     // base points of a block, every checkpoint is a whole number of blocks
+    const int FIRST = 1024;    // base points of the first checkpoint
+    const int ROWS = G + 2;    // evaluations of a point: A, B and A with factor g taken from B
+    long points = FIRST;
+    while (points < samples)
+        points *= 2;
+    int blocks = points / BLOCK;
+    Count(REGRESSION_FACTORIES, points * ROWS);
+
+    // outputs are shifted by the factory at the center, Om is far from 0 compared to its spread
+    double shift;
+    {
+        SimulationContext *context = AcquireContext();
+        FactorySamples center(1);
+        double u[K];
+        std::fill(u, u + K, 0.5);
+        SetInputs(*context, u, center, 0);
+        long Om;
+        Factory(M, Td).ComputeOutputs(center, context->parameters.CToc, &Om, 1);
+        shift = Om;
+        ReleaseContext(context);
+    }
+
+    struct Sums
+    {
+        double a, aa, b, bb;
+        double first[G], total[G];
+    };
+    std::vector<Sums> partial(blocks);
+    threads = WorkerCount(blocks, threads);
+    RunWorkers(blocks, threads, [=, &partial](int begin, int end, unsigned)
+    {
+        SimulationContext *context = AcquireContext();
+        FactorySamples inputs(BLOCK * ROWS);
+        std::vector<long> Om(BLOCK * ROWS);
+        SobolSequence sequence(2 * K); // A in the first K dimensions, B in the rest
+        Factory factory(M, Td);
+        double point[2 * K], u[K];
+        for (int block = begin; block < end; block++)
+        {
+            sequence.Seek(1 + block * BLOCK); // point 0 is all zeros
+            for (int k = 0; k < BLOCK; k++)
+            {
+                sequence.Next(point);
+                SetInputs(*context, point, inputs, k);
+                SetInputs(*context, point + K, inputs, BLOCK + k);
+                for (int g = 0; g < G; g++)
+                {
+                    for (int p = 0; p < K; p++)
+                        u[p] = FACTOR_OF[p] == g ? point[K + p] : point[p];
+                    SetInputs(*context, u, inputs, (2 + g) * BLOCK + k);
+                }
+            }
+            factory.ComputeOutputs(inputs, context->parameters.CToc, Om.data(), BLOCK * ROWS);
+
+            Sums &sums = partial[block];
+            memset(&sums, 0, sizeof(sums));
+            for (int k = 0; k < BLOCK; k++)
+            {
+                double a = Om[k] - shift;
+                double b = Om[BLOCK + k] - shift;
+                sums.a += a;
+                sums.aa += a * a;
+                sums.b += b;
+                sums.bb += b * b;
+                for (int g = 0; g < G; g++)
+                {
+                    double ab = Om[(2 + g) * BLOCK + k] - shift;
+                    sums.first[g] += b * (ab - a);
+                    sums.total[g] += (a - ab) * (a - ab);
+                }
+            }
+        }
+        ReleaseContext(context);
+    });
+
+    // blocks are added in their order, so the indices do not depend on the number of threads
+    NeumaierSum a, aa, b, bb, first[G], total[G];
+    checkpoints.clear();
+    for (int block = 0; block < blocks; block++)
+    {
+        a.Add(partial[block].a);
+        aa.Add(partial[block].aa);
+        b.Add(partial[block].b);
+        bb.Add(partial[block].bb);
+        for (int g = 0; g < G; g++)
+        {
+            first[g].Add(partial[block].first[g]);
+            total[g].Add(partial[block].total[g]);
+        }
+
+        long n = (long)(block + 1) * BLOCK;
+        if (n < FIRST || (n & (n - 1)) != 0)
+            continue;
+        SensitivityIndices indices;
+        indices.samples = n;
+        indices.evaluations = n * ROWS;
+        double mean = (a.Value() + b.Value()) / (2 * n);
+        indices.mean = shift + mean;
+        indices.variance = (aa.Value() + bb.Value()) / (2 * n) - mean * mean;
+        for (int g = 0; g < G; g++)
+        {
+            indices.first[g] = first[g].Value() / n / indices.variance;
+            indices.total[g] = total[g].Value() / (2 * n) / indices.variance;
+        }
+        checkpoints.push_back(indices);
+    }
+}
+
+void RunSensitivity(long samples)
+{
+    const int YEAR = 365*24*60*60;
+    std::vector<SensitivityIndices> checkpoints;
+    EstimateSensitivity(3, YEAR, samples, checkpoints);
+
+    cout << "Sobol indices of Om of a factory with 3 machines working for a year" << endl;
+    cout << "Points\tFactories\tOm mean\tsd\tmax change of first-order\tmax change of total" << endl;
+    for (size_t c = 0; c < checkpoints.size(); c++)
+    {
+        const SensitivityIndices &indices = checkpoints[c];
+        cout << indices.samples << "\t" << indices.evaluations << "\t" << indices.mean << "\t"
+             << std::sqrt(indices.variance);
+        if (c > 0)
+        {
+            double first = 0, total = 0;
+            for (int g = 0; g < G; g++)
+            {
+                first = std::max(first, std::fabs(indices.first[g] - checkpoints[c - 1].first[g]));
+                total = std::max(total, std::fabs(indices.total[g] - checkpoints[c - 1].total[g]));
+            }
+            cout << "\t" << first << "\t" << total;
+        }
+        cout << endl;
+    }
+
+    const SensitivityIndices &result = checkpoints.back();
+    double sum = 0;
+    cout << endl << "Input\tfirst-order\ttotal" << endl;
+    for (int g = 0; g < G; g++)
+    {
+        cout << FactorName(g) << "\t" << result.first[g] << "\t" << result.total[g] << endl;
+        sum += result.first[g];
+    }
+    cout << "Sum of first-order indices: " << sum << endl;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file sensitivity.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Quasi-Monte Carlo variance-based sensitivity analysis of the factory model
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SENSITIVITY_HPP
+#define SENSITIVITY_HPP
+
+#include "simulation.hpp"
+
+/**
+ * @brief Sobol low-discrepancy sequence with the direction numbers of S. Joe and F. Y. Kuo
+ *
+ * Points are generated in Gray code order, so every point costs one XOR
+ * per dimension, and any point can be reached directly by Seek, which lets
+ * threads generate disjoint parts of the sequence.
+ */
+class SobolSequence
+{
+public:
+    static const int MAX_DIMENSIONS = 30;
+
+    explicit SobolSequence(int dimensions);
+
+    /**
+     * @brief Next call of Next returns point @p index
+     */
+    void Seek(uint32_t index);
+
+    /**
+     * @brief Writes the current point to @p point, every coordinate in [0, 1), and moves to the next one
+     */
+    void Next(double *point);
+
+private:
+    static const int BITS = 32;
+
+    int dimensions;
+    std::vector<uint32_t> directions; // BITS direction numbers of every dimension
+    std::vector<uint32_t> state;      // current point scaled by 2^32
+    uint32_t index;                   // index of the current point
+};
+
+/**
+ * @brief First-order and total Sobol indices of the inputs of the factory model
+ */
+struct SensitivityIndices
+{
+    static const int FACTOR_COUNT = 10; // the nine input distributions and the Batch size
+
+    long samples;       // base points of the estimate
+    long evaluations;   // factories evaluated, samples * (FACTOR_COUNT + 2)
+    double mean;        // mean production of a factory
+    double variance;    // variance of production of a factory
+    double first[FACTOR_COUNT];
+    double total[FACTOR_COUNT];
+};
+
+/**
+ * @brief Name of factor @p f of SensitivityIndices
+ */
+const char *FactorName(int f);
+
+/**
+ * @brief Estimates Sobol indices of Om of factories of @p M machines working for @p Td seconds
+ *
+ * Every factor is one input distribution, drawn by one or two parameters
+ * of the model (setup times and downtime durations are drawn both for
+ * Ttotal and for Tb), or the Batch size. Points of a Sobol sequence in
+ * 2 * 14 dimensions are mapped to the inputs through their inverse
+ * distribution functions, first-order indices are estimated by Saltelli's
+ * and total ones by Jansen's estimator. The points are evaluated in fixed
+ * blocks on worker threads and the estimate is taken after 1024, 2048, ...
+ * points, so @p checkpoints shows its convergence.
+ *
+ * @param samples number of base points, rounded up to a power of two
+ * @param checkpoints receives the estimate after every power of two from 1024 on, the last one is the result
+ * @param threads number of worker threads, 0 means workerThreads or one per core
+ */
+void EstimateSensitivity(int M, int Td, long samples, std::vector<SensitivityIndices> &checkpoints,
+                         unsigned threads = 0);
+
+const long MAX_SENSITIVITY_SAMPLES = 1L << 24; // base points of --sensitivity, Seek takes 32 bit indices
+
+/**
+ * @brief Prints Sobol indices of factories working for a year and how they converged
+ */
+void RunSensitivity(long samples);
+
+#endif // SENSITIVITY_HPP
@@ -0,0 +1,383 @@
+/**
+ * @file server.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Long-lived query server on a Unix socket with a cache of results
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <set>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.hpp"
+#include "experiments.hpp"
+#include "shard.hpp"
+#include "sweep.hpp"
+
+const int MAX_REPLICATIONS = 10000;    // replications of a needed query that does not reach its precision
+const size_t MAX_LINE = 65536;         // longest query line
+const double MAX_TARGET = 1e15;        // largest target of needed, the count of factories is bounded by FactoriesNeeded
+const int MIN_QUERY_TIME = 24*60*60;   // shortest Td, shorter ones lose most of it to setups and downtimes
+const int QUERY_YEAR = 365*24*60*60;
+const double MAX_QUERY_YEARS[] = {1e8, 1e4}; // factory-years one query may simulate by Method, about 30 s on one core
+
+ResultCache::ResultCache(size_t capacity):
+    capacity(capacity), hits(0), misses(0)
+{
+}
+
+bool ResultCache::Find(const std::string &key, std::string &answer)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = index.find(key);
+    if (found == index.end())
+        return false;
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    answer = found->second->second;
+    return true;
+}
+
+void ResultCache::Insert(const std::string &key, const std::string &answer)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    misses++;
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        found->second->second = answer;
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+    entries.push_front(std::make_pair(key, answer));
+    index[key] = entries.begin();
+    if (entries.size() > capacity)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+std::string ResultCache::Statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return "hits=" + std::to_string(hits) + " misses=" + std::to_string(misses)
+        + " entries=" + std::to_string(entries.size());
+}
+
+QueryServer::QueryServer(unsigned connections, size_t cacheSize):
+    connections(connections), cache(cacheSize), stopping(false), listener(-1)
+{
+}
+
+/**
+ * @brief Parsed query of the output or needed command
+ */
+struct Query
+{
+    std::string command;
+    Scenario scenario;
+    double target;      // production the needed factories have to exceed
+    double precision;   // relative width of the confidence interval of needed, 0 for 10 replications
+};
+
+/**
+ * @brief Most factories one query of @p scenario may simulate, so that it does not hold the simulation for minutes
+ */
+long QueryFactories(const Scenario &scenario)
+{
+    return std::max(1L, (long)(MAX_QUERY_YEARS[scenario.method] * QUERY_YEAR / scenario.Td));
+}
+
+/**
+ * @brief Parses "command key=value ..." into @p query
+ *
+ * Keys other than target and precision are the keys of the scenario files.
+ *
+ * @return empty string, or the error
+ */
+std::string ParseQuery(const std::string &command, const std::string &arguments, Query &query)
+{
+    query.command = command;
+    query.target = 0;
+    query.precision = 0;
+    std::istringstream tokens(arguments);
+    std::string token, scenarioText = "[query]\n";
+    while (tokens >> token)
+    {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos || equals == 0)
+            return "expected key=value, got " + token;
+        std::string key = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        if (key == "target" || key == "precision")
+        {
+            char *end;
+            double number = strtod(value.c_str(), &end);
+            if (end == value.c_str() || *end != '\0')
+                return key + " has to be a number";
+            (key == "target" ? query.target : query.precision) = number;
+            continue;
+        }
+        scenarioText += key + " = " + value + "\n";
+    }
+    std::istringstream input(scenarioText);
+    ScenarioReader reader(input);
+    if (!reader.Next(query.scenario))
+        return reader.Error();
+
+    if (command == "needed" && (query.target <= 0 || query.target > MAX_TARGET))
+        return "target has to be between 0 and 1e15";
+    if (command == "needed" && query.precision < 0)
+        return "precision has to be positive";
+    if (query.scenario.Td < MIN_QUERY_TIME)
+        return "Td has to be at least " + std::to_string(MIN_QUERY_TIME);
+    if (command == "output" && query.scenario.factories > QueryFactories(query.scenario))
+        return "factories of this Td and method have to be at most " + std::to_string(QueryFactories(query.scenario));
+    return "";
+}
+
+/**
+ * @brief Everything the answer of @p query depends on, as bytes
+ */
+std::string QueryKey(const Query &query)
+{
+    const Scenario &scenario = query.scenario;
+    std::vector<char> key(query.command.begin(), query.command.end());
+    SaveValue(key, scenario.parameters);
+    SaveValue(key, scenario.M);
+    SaveValue(key, scenario.Td);
+    SaveValue(key, scenario.stream);
+    SaveValue(key, simulationSeed);
+    SaveValue(key, scenario.method);
+    if (query.command == "needed")
+    {
+        SaveValue(key, query.target);
+        SaveValue(key, query.precision);
+    }
+    else
+        SaveValue(key, scenario.factories);
+    return std::string(key.begin(), key.end());
+}
+
+/**
+ * @brief Simulates @p query, must not run concurrently with another simulation
+ */
+std::string EvaluateQuery(const Query &query)
+{
+    const Scenario &scenario = query.scenario;
+    std::ostringstream answer;
+    answer.precision(10);
+    ModelParameters previous = modelParameters;
+    if (query.command == "needed")
+    {
+        SetModelParameters(scenario.parameters);
+        RunningStatistics factories;
+        double halfWidth;
+        long budget = QueryFactories(scenario); // left for the replications
+        int limit = std::min<long>(budget / 10, MAX_NEEDED_FACTORIES);
+        do
+        {
+            for (int i = 0; i < 10; i++)
+            {
+                int needed = limit < 1 ? -1 : FactoriesNeeded(scenario.M, scenario.Td, query.target,
+                                                               scenario.stream + factories.Count(), NULL, NULL, 0, NULL,
+                                                               scenario.method, limit);
+                if (needed < 0)
+                {
+                    SetModelParameters(previous);
+                    return "error the factories manufacture nothing or more than " + std::to_string(limit)
+                         + " of them would be needed";
+                }
+                factories.Add(needed);
+                budget -= needed;
+            }
+            halfWidth = ConfidenceHalfWidth(std::sqrt(factories.SampleVariance()), factories.Count());
+        } while (query.precision > 0 && 2 * halfWidth > query.precision * factories.Mean()
+                 && factories.Count() < MAX_REPLICATIONS && budget >= 10 * factories.Max());
+        answer << "ok factories=" << factories.Mean() << " low=" << factories.Mean() - halfWidth
+               << " high=" << factories.Mean() + halfWidth << " replications=" << factories.Count();
+    }
+    else
+    {
+        ShardJob job = {scenario.parameters, scenario.M, scenario.Td, scenario.stream, scenario.factories, scenario.method};
+        ShardResult result;
+        SimulateShard(job, 0, job.count, result);
+        const RunningStatistics &statistics = result.statistics;
+        answer << "ok total=" << result.total << " mean=" << statistics.Mean() << " sd=" << statistics.StandardDeviation()
+               << " min=" << statistics.Min() << " max=" << statistics.Max() << " p50=" << statistics.Quantile(0.5)
+               << " p95=" << statistics.Quantile(0.95) << " p99=" << statistics.Quantile(0.99);
+    }
+    SetModelParameters(previous);
+    return answer.str();
+}
+
+std::string QueryServer::Answer(const std::string &line)
+{
+    std::istringstream input(line);
+    std::string command, arguments;
+    input >> command;
+    std::getline(input, arguments);
+
+    if (command == "stats")
+        return "ok " + cache.Statistics();
+    if (command == "shutdown")
+    {
+        stopping = true;
+        int socket = listener;
+        if (socket >= 0)
+            shutdown(socket, SHUT_RDWR); // wakes up accept
+        return "ok";
+    }
+    if (command != "output" && command != "needed")
+        return "error unknown command " + command;
+
+    Query query;
+    std::string error = ParseQuery(command, arguments, query);
+    if (!error.empty())
+        return "error " + error;
+    std::string key = QueryKey(query), answer;
+    if (cache.Find(key, answer))
+        return answer + " cached=1";
+
+    std::lock_guard<std::mutex> lock(simulationMutex);
+    if (cache.Find(key, answer)) // simulated by another connection while this one waited
+        return answer + " cached=1";
+    answer = EvaluateQuery(query);
+    cache.Insert(key, answer);
+    return answer + " cached=0";
+}
+
+/**
+ * @brief Answers the lines of one connection until the client closes it
+ */
+void QueryServer::Serve(int connection)
+{
+    std::string buffer;
+    char data[4096];
+    while (true)
+    {
+        ssize_t n = read(connection, data, sizeof(data));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buffer.append(data, n);
+        size_t end;
+        while ((end = buffer.find('\n')) != std::string::npos)
+        {
+            std::string line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            if (line.empty())
+                continue;
+            std::string answer;
+            try
+            {
+                answer = Answer(line) + "\n";
+            }
+            catch (const std::exception &exception) // one query must not stop the server
+            {
+                answer = std::string("error ") + exception.what() + "\n";
+            }
+            if (!WriteFull(connection, answer.data(), answer.size()))
+                return;
+        }
+        if (buffer.size() > MAX_LINE)
+        {
+            const char error[] = "error line too long\n";
+            WriteFull(connection, error, sizeof(error) - 1);
+            return;
+        }
+    }
+}
+
+bool QueryServer::Run(const std::string &path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path " << path << " is too long" << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str()); // left by a server that did not shut down
+    if (socket < 0 || bind(socket, (sockaddr *)&address, sizeof(address)) != 0 || listen(socket, 64) != 0)
+    {
+        std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+        if (socket >= 0)
+            close(socket);
+        return false;
+    }
+    listener = socket;
+    signal(SIGPIPE, SIG_IGN); // a client that went away is noticed by the failed write
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<int> queue;     // accepted connections waiting for a thread, -1 stops a thread
+    std::set<int> open;        // connections being served
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < connections; t++)
+    {
+        pool.push_back(std::thread([&]()
+        {
+            while (true)
+            {
+                int connection;
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    queueChanged.wait(lock, [&]() { return !queue.empty(); });
+                    connection = queue.front();
+                    queue.pop_front();
+                    if (connection < 0)
+                        return;
+                    open.insert(connection);
+                }
+                Serve(connection);
+                std::lock_guard<std::mutex> lock(queueMutex);
+                open.erase(connection);
+                close(connection);
+            }
+        }));
+    }
+
+    while (!stopping)
+    {
+        int connection = accept4(socket, NULL, NULL, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(connection);
+        queueChanged.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for (int connection : open)
+            shutdown(connection, SHUT_RDWR); // idle clients would keep their threads
+        for (int connection : queue)
+            close(connection);
+        queue.assign(connections, -1);
+        queueChanged.notify_all();
+    }
+    for (unsigned t = 0; t < connections; t++)
+        pool[t].join();
+    listener = -1;
+    close(socket);
+    unlink(path.c_str());
+    return true;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file server.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Long-lived query server on a Unix socket with a cache of results
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "simulation.hpp"
+
+/**
+ * @brief Thread-safe cache of answers, the least recently used one is dropped when it is full
+ */
+class ResultCache
+{
+public:
+    explicit ResultCache(size_t capacity);
+
+    /**
+     * @brief Finds the answer of @p key and marks it as recently used
+     */
+    bool Find(const std::string &key, std::string &answer);
+
+    /**
+     * @brief Stores the answer of @p key that was not found, counted as a miss
+     */
+    void Insert(const std::string &key, const std::string &answer);
+
+    /**
+     * @brief "hits=H misses=M entries=E" of the cache
+     */
+    std::string Statistics();
+
+private:
+    typedef std::list<std::pair<std::string, std::string> > Entries;
+
+    size_t capacity;
+    Entries entries; // most recently used first
+    std::unordered_map<std::string, Entries::iterator> index;
+    std::mutex mutex;
+    long hits;
+    long misses;
+};
+
+const unsigned SERVER_CONNECTIONS = 8;   // connections of --serve served at once
+const size_t SERVER_CACHE_SIZE = 4096;   // answers of --serve kept in the cache
+
+/**
+ * @brief Answers queries about the model sent as text lines over a Unix socket
+ *
+ * Every line is a command followed by key=value arguments and gets one
+ * line back, "ok key=value ..." or "error message":
+ *
+ * - output factories=N M=3 Td=S: total, mean, sd and percentiles of
+ *   production of N factories working for S seconds
+ * - needed target=X M=3 Td=S precision=W: mean number of factories that
+ *   manufacture more than X in S seconds, simulated by the method of the
+ *   query; replications are added until the confidence interval is
+ *   narrower than W times the mean (10 of them for 0)
+ * - stats: hits and misses of the cache
+ * - shutdown: stops the server
+ *
+ * Model inputs and method and stream are set by the keys of the scenario
+ * files (see ScenarioReader). Answers are cached by the query, the model,
+ * the seed and the precision, so a repeated query does not simulate
+ * anything. Connections are served by a pool of threads; simulations run
+ * one at a time under simulationMutex, each of them on all threads of
+ * workerPool.
+ */
+class QueryServer
+{
+public:
+    /**
+     * @param connections threads serving the connections
+     * @param cacheSize answers kept in the cache
+     */
+    QueryServer(unsigned connections, size_t cacheSize);
+
+    /**
+     * @brief Listens on @p path until a shutdown query
+     *
+     * @return false when the socket cannot be created
+     */
+    bool Run(const std::string &path);
+
+    /**
+     * @brief Answer to one query line, without the newline
+     */
+    std::string Answer(const std::string &line);
+
+private:
+    void Serve(int connection);
+
+    unsigned connections;
+    ResultCache cache;
+    std::mutex simulationMutex; // the model parameters are global, one simulation at a time
+    std::atomic<bool> stopping;
+    std::atomic<int> listener; // socket accepting the connections, -1 when not running
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,348 @@
+/**
+ * @file shard.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Splitting of large simulations into shards run by worker processes
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shard.hpp"
+
+const uint32_t REQUEST_MAGIC = 0x53485251; // "QRHS", version 1 of the requests
+const uint32_t REPLY_MAGIC = 0x53485250;   // "PRHS", version 1 of the replies
+
+/**
+ * @brief Shard sent to a worker, followed by nothing
+ *
+ * Structures are sent as they are in memory, so the workers have to be
+ * the same build on a machine with the same byte order.
+ */
+struct ShardRequest
+{
+    uint32_t magic;
+    uint32_t shard;
+    uint32_t first;     // index of the first factory in the stream
+    int32_t count;
+    int32_t M;
+    int32_t Td;
+    uint32_t stream;
+    int32_t method;
+    ModelParameters parameters;
+};
+
+/**
+ * @brief Reply of a worker, followed by @p size bytes of saved RunningStatistics
+ */
+struct ShardReply
+{
+    uint32_t magic;
+    uint32_t shard;
+    int64_t total;
+    uint64_t size;
+};
+
+bool ReadFull(int fd, void *data, size_t size)
+{
+    char *position = (char *)data;
+    while (size > 0)
+    {
+        ssize_t n = read(fd, position, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        position += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool WriteFull(int fd, const void *data, size_t size)
+{
+    const char *position = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, position, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        position += n;
+        size -= n;
+    }
+    return true;
+}
+
+void SimulateShard(const ShardJob &job, uint32_t first, int count, ShardResult &result)
+{
+    SetModelParameters(job.parameters);
+    // factories are simulated block by block into one buffer, memory does not grow with the shard
+    std::vector<long> outputs(std::min(count, SHARD_BLOCK));
+    result.total = 0;
+    result.statistics = RunningStatistics();
+    for (int done = 0; done < count; done += SHARD_BLOCK)
+    {
+        int n = std::min(SHARD_BLOCK, count - done);
+        result.total += SimulateFactories(job.M, n, job.Td, outputs.data(), job.stream, first + done, job.method);
+        for (int i = 0; i < n; i++)
+            result.statistics.Add(outputs[i]);
+    }
+}
+
+int RunWorker()
+{
+    ShardRequest request;
+    std::vector<char> payload;
+    while (ReadFull(0, &request, sizeof(request)))
+    {
+        if (request.magic != REQUEST_MAGIC || request.count < 0)
+        {
+            std::cerr << "Worker: unknown request" << std::endl;
+            return 1;
+        }
+        ShardJob job;
+        job.parameters = request.parameters;
+        job.M = request.M;
+        job.Td = request.Td;
+        job.stream = request.stream;
+        job.count = request.count;
+        job.method = (Method)request.method;
+
+        ShardResult result;
+        SimulateShard(job, request.first, request.count, result);
+        payload.clear();
+        result.statistics.Save(payload);
+        ShardReply reply = {REPLY_MAGIC, request.shard, result.total, payload.size()};
+        if (!WriteFull(1, &reply, sizeof(reply)) || !WriteFull(1, payload.data(), payload.size()))
+            return 1;
+    }
+    return 0;
+}
+
+Coordinator::Coordinator(unsigned processes, int shardSize, const std::string &command, int timeout):
+    workers(processes), shardSize(shardSize), command(command), timeout(timeout)
+{
+    signal(SIGPIPE, SIG_IGN); // a dead worker is noticed by the failed write
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].pid = -1;
+        Start(workers[w]);
+    }
+}
+
+Coordinator::~Coordinator()
+{
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        if (workers[w].pid < 0)
+            continue;
+        close(workers[w].input); // worker ends at the end of its stdin
+        close(workers[w].output);
+        waitpid(workers[w].pid, NULL, 0);
+    }
+}
+
+bool Coordinator::Start(Worker &worker)
+{
+    int requests[2], replies[2];
+    if (pipe(requests) != 0)
+        return false;
+    if (pipe(replies) != 0)
+    {
+        close(requests[0]);
+        close(requests[1]);
+        return false;
+    }
+    // workers started later must not inherit pipes of the others
+    fcntl(requests[1], F_SETFD, FD_CLOEXEC);
+    fcntl(replies[0], F_SETFD, FD_CLOEXEC);
+
+    std::string seed = "--seed=" + std::to_string(simulationSeed);
+    std::string shell = command + " --worker " + seed;
+    // local workers share the cores of this host, a worker command runs on its own host with all of them
+    unsigned cores = WorkerCount(INT32_MAX, 0);
+    std::string threads = "--threads=" + std::to_string(std::max(1u, cores / (unsigned)workers.size()));
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(requests[0], 0);
+        dup2(replies[1], 1);
+        close(requests[0]);
+        close(replies[1]);
+        if (command.empty())
+            execl("/proc/self/exe", "simulation", "--worker", seed.c_str(), threads.c_str(), (char *)NULL);
+        else
+            execl("/bin/sh", "sh", "-c", shell.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    close(requests[0]);
+    close(replies[1]);
+    if (pid < 0)
+    {
+        close(requests[1]);
+        close(replies[0]);
+        worker.pid = -1;
+        return false;
+    }
+    worker.pid = pid;
+    worker.input = requests[1];
+    worker.output = replies[0];
+    worker.shard = -1;
+    return true;
+}
+
+void Coordinator::Stop(Worker &worker)
+{
+    if (worker.pid < 0)
+        return;
+    kill(worker.pid, SIGKILL);
+    close(worker.input);
+    close(worker.output);
+    waitpid(worker.pid, NULL, 0);
+    worker.pid = -1;
+}
+
+bool Coordinator::Run(const ShardJob &job, ShardResult &result)
+{
+    struct Shard
+    {
+        uint32_t first;
+        int count;
+        int attempts;
+        bool done;
+        ShardResult result;
+    };
+
+    int size = shardSize > 0 ? shardSize : std::max(1, (int)((job.count + 4 * workers.size() - 1) / (4 * workers.size())));
+    std::vector<Shard> shards;
+    for (int first = 0; first < job.count; first += size)
+    {
+        Shard shard;
+        shard.first = first;
+        shard.count = std::min(size, job.count - first);
+        shard.attempts = 0;
+        shard.done = false;
+        shards.push_back(shard);
+    }
+
+    std::vector<int> pending; // shards waiting for a worker, next one at the back
+    for (int s = shards.size() - 1; s >= 0; s--)
+        pending.push_back(s);
+    size_t done = 0;
+    std::vector<char> payload;
+
+    // a failed worker is replaced and its shard goes back to the queue
+    auto fail = [&](Worker &worker, const char *reason) -> bool
+    {
+        int s = worker.shard;
+        std::cerr << "Worker " << worker.pid << " " << reason;
+        Stop(worker);
+        if (++shards[s].attempts >= MAX_ATTEMPTS)
+        {
+            std::cerr << ", shard " << s << " failed " << MAX_ATTEMPTS << " times" << std::endl;
+            return false;
+        }
+        std::cerr << ", shard " << s << " is sent again" << std::endl;
+        pending.push_back(s);
+        return Start(worker);
+    };
+
+    while (done < shards.size())
+    {
+        std::vector<pollfd> polled;
+        std::vector<size_t> polledWorkers;
+        for (size_t w = 0; w < workers.size(); w++)
+        {
+            Worker &worker = workers[w];
+            if (worker.pid < 0 && !Start(worker))
+                return false;
+            if (worker.shard < 0 && !pending.empty())
+            {
+                int s = pending.back();
+                pending.pop_back();
+                ShardRequest request = {REQUEST_MAGIC, (uint32_t)s, shards[s].first, shards[s].count,
+                                        job.M, job.Td, job.stream, job.method, job.parameters};
+                worker.shard = s;
+                worker.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+                if (!WriteFull(worker.input, &request, sizeof(request)))
+                {
+                    if (!fail(worker, "does not accept requests"))
+                        return false;
+                    continue;
+                }
+            }
+            if (worker.shard >= 0)
+            {
+                pollfd fd = {worker.output, POLLIN, 0};
+                polled.push_back(fd);
+                polledWorkers.push_back(w);
+            }
+        }
+        if (polled.empty())
+            continue;
+        // wake up at the earliest deadline, a hanging worker never closes its pipe
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(), earliest = now;
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            const Worker &worker = workers[polledWorkers[i]];
+            if (i == 0 || worker.deadline < earliest)
+                earliest = worker.deadline;
+        }
+        long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(earliest - now).count() + 1;
+        if (poll(polled.data(), polled.size(), (int)std::max(0LL, std::min(wait, (long long)INT32_MAX))) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            Worker &worker = workers[polledWorkers[i]];
+            if (polled[i].revents == 0)
+            {
+                if (now >= worker.deadline && !fail(worker, "did not finish its shard in time"))
+                    return false;
+                continue;
+            }
+            Shard &shard = shards[worker.shard];
+            ShardReply reply;
+            bool ok = ReadFull(worker.output, &reply, sizeof(reply)) && reply.magic == REPLY_MAGIC
+                && reply.shard == (uint32_t)worker.shard && reply.size < (1u << 30);
+            if (ok)
+            {
+                payload.resize(reply.size);
+                const char *data = payload.data();
+                ok = ReadFull(worker.output, payload.data(), reply.size)
+                    && shard.result.statistics.Load(data, data + reply.size)
+                    && shard.result.statistics.Count() == shard.count;
+            }
+            if (!ok)
+            {
+                if (!fail(worker, "died or sent a broken reply"))
+                    return false;
+                continue;
+            }
+            shard.result.total = reply.total;
+            shard.done = true;
+            worker.shard = -1;
+            done++;
+        }
+    }
+
+    result.total = 0;
+    result.statistics = RunningStatistics();
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        result.total += shards[s].result.total;
+        result.statistics.Merge(shards[s].result.statistics);
+    }
+    return true;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file shard.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Splitting of large simulations into shards run by worker processes
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <string>
+#include <sys/types.h>
+#include "simulation.hpp"
+
+/**
+ * @brief Factories simulated by one call of Coordinator::Run
+ */
+struct ShardJob
+{
+    ModelParameters parameters;
+    int M;              // Number of machines
+    int Td;             // Time factory is working [seconds]
+    uint32_t stream;    // stream the factories are drawn from
+    int count;          // number of factories
+    Method method;
+};
+
+/**
+ * @brief Production of the factories of a job or of one of its shards
+ */
+struct ShardResult
+{
+    long long total;                // production of all factories
+    RunningStatistics statistics;   // production of one factory
+
+    ShardResult():
+        total(0)
+    {
+    }
+};
+
+/**
+ * @brief Reads exactly @p size bytes, false on end of file or error
+ */
+bool ReadFull(int fd, void *data, size_t size);
+
+/**
+ * @brief Writes exactly @p size bytes, false on error
+ */
+bool WriteFull(int fd, const void *data, size_t size);
+
+const int SHARD_BLOCK = 64 * SimulationContext::BATCH_SIZE; // factories of a shard simulated at once
+
+/**
+ * @brief Simulates factories @p first .. @p first + @p count - 1 of @p job in this process
+ *
+ * Blocks of SHARD_BLOCK factories go through one buffer into the statistics,
+ * so memory does not depend on @p count.
+ */
+void SimulateShard(const ShardJob &job, uint32_t first, int count, ShardResult &result);
+
+/**
+ * @brief Serves shards sent by a coordinator on stdin and writes results to stdout until stdin is closed
+ *
+ * @return exit code of the worker
+ */
+int RunWorker();
+
+/**
+ * @brief Runs jobs on a set of worker processes
+ *
+ * A job is split into shards of consecutive factories, every idle worker
+ * gets the next shard over a pipe and the results are merged in the order
+ * of the shards, so the total equals the result of one process and the
+ * statistics differ from it by rounding only. Workers are this
+ * program started with --worker, or @p command run by /bin/sh, which can
+ * start the worker on another host (e.g. "ssh host ./simulation"). A worker
+ * that dies or sends a broken reply is replaced and its shard is sent again.
+ */
+const int SHARD_TIMEOUT = 3600;     // default seconds of one shard, a worker hanging longer is restarted
+const unsigned MAX_PROCESSES = 1024; // most worker processes of --processes
+
+class Coordinator
+{
+public:
+    /**
+     * @param processes number of worker processes
+     * @param shardSize factories per shard, 0 splits every job into four shards per worker
+     * @param command command starting a worker, empty for this program
+     * @param timeout seconds a worker has for one shard before it is killed and the shard is sent again
+     */
+    Coordinator(unsigned processes, int shardSize, const std::string &command, int timeout = SHARD_TIMEOUT);
+    ~Coordinator();
+
+    /**
+     * @brief Simulates @p job on the workers
+     *
+     * @return false when a shard failed MAX_ATTEMPTS times or a worker cannot be started
+     */
+    bool Run(const ShardJob &job, ShardResult &result);
+
+    static const int MAX_ATTEMPTS = 3;
+
+private:
+    struct Worker
+    {
+        pid_t pid;
+        int input;   // requests to the worker
+        int output;  // replies of the worker
+        int shard;   // shard being simulated, -1 when idle
+        std::chrono::steady_clock::time_point deadline; // of the shard being simulated
+    };
+
+    bool Start(Worker &worker);
+    void Stop(Worker &worker);
+
+    std::vector<Worker> workers;
+    int shardSize;
+    std::string command;
+    int timeout;
+};
+
+#endif // SHARD_HPP
@@ -7,549 +7,776 @@
  * @copyright Copyright (c) 2021
  */
 
-#include <iostream>
-#include <random>
-#include <cmath>
-#include <stdlib.h>
-#include <chrono>
-#include <cstring>
+#include "simulation.hpp"
 
+uint64_t simulationSeed = 0;
 
-typedef std::chrono::high_resolution_clock myclock;
-using std::cout;
-using std::endl;
-
-double TruncateNumber(double In, unsigned int Digits)
+/**
+ * @brief Moves @p generator to the stream of the given factory and parameter
+ *
+ * With @p antithetic, factories 2k and 2k+1 share a stream and the odd one
+ * reads it mirrored, so every input of the pair is negatively correlated
+ * while each factory keeps the exact input distributions.
+ */
+void SeekFactory(RandomEngine &generator, uint32_t stream, uint32_t factory, uint32_t parameter, bool antithetic)
 {
-    double f = pow(10, Digits);
-    return ((int)(In*f))/f;
+    if (antithetic)
+        generator.Seek(stream, factory & ~1u, parameter, factory & 1);
+    else
+        generator.Seek(stream, factory, parameter);
 }
 
 /**
- * @brief Generates random number in normal distribution
- * 
+ * @brief Rational approximation of the standard normal quantile by P. J. Acklam, relative error below 1.15e-9
  */
-class NormalDistribution {
-    myclock::time_point beginning = myclock::now();
-    std::default_random_engine generator;
-    std::normal_distribution<double> distribution;
-    double min;
-    double max;
-public:
-    NormalDistribution(double min, double max):
-        distribution((min + max) / 2, (max - min) / 4), min(min), max(max)
+double AcklamQuantile(double p)
+{
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    const double low = 0.02425;
+    if (p < low)
     {
-        myclock::duration d = myclock::now() - beginning;
-        unsigned seed = d.count();
-        generator.seed(seed);
+        double q = std::sqrt(-2 * std::log(p));
+        return (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+               ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
     }
-
-    double operator ()() {
-        while (true) {
-            double number = this->distribution(generator);
-            if (number >= this->min && number <= this->max)
-                return TruncateNumber(number,3);
-        }
-    }
-};
+    if (p > 1 - low)
+        return -AcklamQuantile(1 - p);
+    double q = p - 0.5;
+    double r = q * q;
+    return (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q /
+           (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+}
 
 /**
- * @brief Generates random number in exponential distribution
- * 
+ * @brief Quantile function of the standard normal distribution
+ *
+ * Acklam's approximation refined by one Halley step on erfc, accurate to
+ * about the double precision, as the tables of NormalDistribution need.
  */
-class ExponentialDistribution {
-    myclock::time_point beginning = myclock::now();
-    std::default_random_engine generator;
-    std::exponential_distribution<> distribution;
-    double min;
-    double max;
-public:
-    ExponentialDistribution(double min, double max):
-        distribution(1 /((max - min) / (-std::log(0.05)))), min(min), max(max)
+double NormalQuantile(double p)
+{
+    double x = AcklamQuantile(p);
+    if (p <= 0 || p >= 1)
+        return x;
+    double e = 0.5 * std::erfc(-x / M_SQRT2) - p;
+    double u = e * std::sqrt(2 * M_PI) * std::exp(x * x / 2);
+    return x - u / (1 + x * u / 2);
+}
+
+void PhiloxEngine::Uniforms(uint32_t stream, uint32_t first, uint32_t parameter, bool antithetic, double *out,
+                            int n) const
+{
+    int i = 0;
+#if defined(__AVX2__)
+    // four factories in the 64 bit lanes, every 32 bit word of the block in the low half of its lane
+    const __m256i low = _mm256_set1_epi64x(0xFFFFFFFF);
+    const __m256i m0 = _mm256_set1_epi64x(0xD2511F53), m1 = _mm256_set1_epi64x(0xCD9E8D57);
+    const __m256i c1 = _mm256_set1_epi64x(parameter), c3 = _mm256_set1_epi64x(stream);
+    const __m256i pair = _mm256_set1_epi64x(antithetic ? 0xFFFFFFFE : 0xFFFFFFFF);
+    const __m256i odd = _mm256_set1_epi64x(antithetic ? 1 : 0);
+    const __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+    const __m256i exponent = _mm256_set1_epi64x(0x4330000000000000); // 2^52, integers below it are its mantissa
+    const __m256d two52 = _mm256_castsi256_pd(exponent);
+    const __m256d two26 = _mm256_set1_pd(1 << 26), scale = _mm256_set1_pd(1.0 / (1ULL << 53));
+    __m256i keys0[10], keys1[10];
+    for (int round = 0; round < 10; round++)
     {
-        myclock::duration d = myclock::now() - beginning;
-        unsigned seed = d.count();
-        generator.seed(seed);
+        keys0[round] = _mm256_set1_epi64x((uint32_t)(key[0] + round * 0x9E3779B9u));
+        keys1[round] = _mm256_set1_epi64x((uint32_t)(key[1] + round * 0xBB67AE85u));
     }
-
-    double operator ()() {
-        while (true) {
-            double number = this->distribution(generator) + min; // shifted
-            if (number >= this->min && number <= this->max)
-                return TruncateNumber(number,3);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i factory = _mm256_and_si256(_mm256_add_epi64(_mm256_set1_epi64x(first + i), lanes), low);
+        __m256i x0 = _mm256_setzero_si256(), x1 = c1, x2 = _mm256_and_si256(factory, pair), x3 = c3;
+        for (int round = 0; round < 10; round++)
+        {
+            __m256i p0 = _mm256_mul_epu32(m0, x0);
+            __m256i p1 = _mm256_mul_epu32(m1, x2);
+            x0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), x1), keys0[round]);
+            x2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), x3), keys1[round]);
+            x1 = _mm256_and_si256(p1, low);
+            x3 = _mm256_and_si256(p0, low);
         }
+        __m256i number = _mm256_or_si256(_mm256_slli_epi64(x1, 32), x0);
+        __m256i mirror = _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(factory, odd));
+        __m256i y = _mm256_srli_epi64(_mm256_xor_si256(number, mirror), 11);
+        // 53 bits do not fit the mantissa trick, so the high 27 and low 26 bits are converted separately
+        __m256d high = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(y, 26), exponent)), two52);
+        __m256d rest = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+            _mm256_and_si256(y, _mm256_set1_epi64x((1 << 26) - 1)), exponent)), two52);
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(high, two26), rest), scale));
+    }
+#endif
+    PhiloxEngine engine(*this);
+    for (; i < n; i++)
+    {
+        SeekFactory(engine, stream, first + i, parameter, antithetic);
+        out[i] = UniformNumber(engine);
+    }
+}
+
+void QuantileTable::Transform(double *values, int n) const
+{
+    const double *table = coefficients.data();
+    int i = 0;
+#if defined(__AVX__)
+    // the four coefficients of a step are loaded together and transposed to one register per power of t
+    const __m256d knots = _mm256_set1_pd(KNOTS);
+    int steps[4];
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_mul_pd(_mm256_loadu_pd(values + i), knots);
+        __m128i j = _mm256_cvttpd_epi32(x);
+        __m256d t = _mm256_sub_pd(x, _mm256_cvtepi32_pd(j));
+        _mm_storeu_si128((__m128i *)steps, j);
+        __m256d r0 = _mm256_loadu_pd(table + 4 * steps[0]);
+        __m256d r1 = _mm256_loadu_pd(table + 4 * steps[1]);
+        __m256d r2 = _mm256_loadu_pd(table + 4 * steps[2]);
+        __m256d r3 = _mm256_loadu_pd(table + 4 * steps[3]);
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+        __m256d c0 = _mm256_permute2f128_pd(t0, t2, 0x20), c1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+        __m256d c2 = _mm256_permute2f128_pd(t0, t2, 0x31), c3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+        // multiplications and additions stay separate, so the result is the one of the scalar loop
+        __m256d y = _mm256_add_pd(c2, _mm256_mul_pd(t, c3));
+        y = _mm256_add_pd(c1, _mm256_mul_pd(t, y));
+        y = _mm256_add_pd(c0, _mm256_mul_pd(t, y));
+        _mm256_storeu_pd(values + i, y);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        double x = values[i] * KNOTS;
+        int j = (int)x;
+        double t = x - j;
+        const double *c = table + 4 * j;
+        values[i] = c[0] + t * (c[1] + t * (c[2] + t * c[3]));
     }
-};
+}
 
 /**
- * @brief Represents the semiconductors factory
- * 
+ * @brief Truncates every value of the array to the precision given by @p f
+ *
+ * Values are cut towards zero to multiples of 1 / @p f, @p f = 10^Digits
+ * is computed once by the caller and the array is processed with AVX or
+ * SSE2 when available.
  */
-class Factory
+void TruncateNumbers(double *values, int n, double f)
 {
-public:
-    
-    int M;  // Number of machines
-    int Td; // Time factory is working [seconds]
-    Factory(int m = 3, int td = 60*60*24)
+    int i = 0;
+#if defined(__AVX__)
+    __m256d scale = _mm256_set1_pd(f);
+    for (; i + 4 <= n; i += 4)
     {
-        M = m;
-        Td = td;
+        __m256d x = _mm256_mul_pd(_mm256_loadu_pd(values + i), scale);
+        x = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        _mm256_storeu_pd(values + i, _mm256_div_pd(x, scale));
     }
+#elif defined(__SSE2__)
+    __m128d scale = _mm_set1_pd(f);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_mul_pd(_mm_loadu_pd(values + i), scale);
+        x = _mm_cvtepi32_pd(_mm_cvttpd_epi32(x));
+        _mm_storeu_pd(values + i, _mm_div_pd(x, scale));
+    }
+#endif
+    for (; i < n; i++)
+        values[i] = ((int)(values[i]*f))/f;
+}
 
-    /**
-     * @brief Simulates the model factory
-     * 
-     * @return number of semiconductors manufactured per @param Td
-     */
-    long SimulateTime()
+constexpr RegressionTerm PaperModel::TERMS[];
+constexpr int PaperModel::BATCH_SIZES[];
+
+OutputsKernel SelectOutputsKernel(int M)
+{
+    // the usual line sizes get kernels with M folded in, add a case for another one
+    switch (M)
     {
-        NormalDistribution CTwb(6.0902, 6.4609);   // Cycle Time Wire Bond
-        NormalDistribution CTda(2.8072, 2.9460);   // Cycle Time Die Attach
-        NormalDistribution CTpc(0.9882, 1.0498);   // Cycle Time Pre-Cap Inspection
-        ExponentialDistribution DDda(2141, 4391);  // Downtime Duration Die Attach
-        ExponentialDistribution DDwb(1364, 2797);  // Downtime Duration Wire Bond
-        ExponentialDistribution DFda(1066, 2187);  // Downtime Frequency Die Attach
-        ExponentialDistribution DFwb(1421, 2193);  // Downtime Frequency Wire Bond
-        ExponentialDistribution STda(2957, 6063);  // Setup Time Die Attach
-        ExponentialDistribution STwb (1324, 2714); // Setup Time Wire Bond
-
-        int Q[] = {2200,3080,11264}; // Batch size 
-        srand(time(NULL));
-        int Qcur = Q[0];
-
-        int CToc = 7200; // Cycle Time Oven Cure
-
-        Qcur = Q[rand() % 3];
-        long Ttotal= ( (Td-STda())*((86400-DDda())/86400) + Td +(Td-STwb())*((86400-DDwb())/86400)+Td ) * M ;
-        long Tb = CToc + 387.1239*(CTda()-2.8766)/0.0694 + 1008.0011*(CTwb()-6.2756)/0.1854 +
-            157.9690*(CTpc()-1.019)/0.0308 + 9.5167*(DDda()-3266)/1125 + 3.9325*(DDwb()-2080.5)/716.5 +
-            2.4477*(DFda()-1626.5)/560.5 - 0.1807*(DFwb()-1807)/386 - 2.6148*(STda()-4510)/1553 +
-            24.3713*(STwb()-2019)/695 + 10.1729*Qcur;
-
-        long Om = Ttotal * Qcur / Tb;
-
-        return Om;
+    case 1: return FactoryModel<PaperModel, 1>::ComputeOutputs;
+    case 2: return FactoryModel<PaperModel, 2>::ComputeOutputs;
+    case 3: return FactoryModel<PaperModel, 3>::ComputeOutputs;
+    case 4: return FactoryModel<PaperModel, 4>::ComputeOutputs;
+    default: return FactoryModel<PaperModel, 0>::ComputeOutputs;
     }
-};
+}
 
+ModelParameters modelParameters;
+unsigned modelGeneration = 0; // incremented by every change of modelParameters
 
-/**
- * @brief Generates size factories with parameters
- *
- * @param size size of factory (m)
- * @param count count of facotries to be generated
- * @param time time, the factories will be working [sec]
- * @return  number of semiconductors per @time from @count facotries of @size 
- */
-long GenerateFactories(int size, int count, int time)
+void SetModelParameters(const ModelParameters &parameters)
 {
-    long num = 0;
-    for (int i = 0 ; i < count ; i++)
+    modelParameters = parameters;
+    modelGeneration++;
+}
+
+const int SimulationContext::BATCH_SIZE;
+
+void SimulationContext::Configure(const ModelParameters &parameters)
+{
+    CTwb = NormalDistribution(parameters.CTwb.min, parameters.CTwb.max);
+    CTda = NormalDistribution(parameters.CTda.min, parameters.CTda.max);
+    CTpc = NormalDistribution(parameters.CTpc.min, parameters.CTpc.max);
+    DDda = ExponentialDistribution(parameters.DDda.min, parameters.DDda.max);
+    DDwb = ExponentialDistribution(parameters.DDwb.min, parameters.DDwb.max);
+    DFda = ExponentialDistribution(parameters.DFda.min, parameters.DFda.max);
+    DFwb = ExponentialDistribution(parameters.DFwb.min, parameters.DFwb.max);
+    STda = ExponentialDistribution(parameters.STda.min, parameters.STda.max);
+    STwb = ExponentialDistribution(parameters.STwb.min, parameters.STwb.max);
+    this->parameters = parameters;
+    line.Configure(parameters);
+}
+
+double SimulationContext::InputMean(int parameter) const
+{
+    switch (parameter)
     {
-        Factory *factory = new Factory(size, time);
-        int Om = factory->SimulateTime();
-        num += Om;
+    case CTWB: return CTwb.Mean();
+    case CTDA: return CTda.Mean();
+    case CTPC: return CTpc.Mean();
+    case DDDA: case TT_DDDA: return DDda.Mean();
+    case DDWB: case TT_DDWB: return DDwb.Mean();
+    case DFDA: return DFda.Mean();
+    case DFWB: return DFwb.Mean();
+    case STDA: case TT_STDA: return STda.Mean();
+    case STWB: case TT_STWB: return STwb.Mean();
+    default: return (parameters.Q[0] + parameters.Q[1] + parameters.Q[2]) / 3.0; // Batch size
     }
-    return num;
 }
 
+std::mutex contextPoolMutex;
+std::vector<std::unique_ptr<SimulationContext> > contextPool; // contexts not used by any thread
+
 /**
- * @brief Calculates mean and standart deviation of model and our representation
- * 
+ * @brief Takes a simulation context from the shared pool, creating one when the pool is empty
+ *
+ * Contexts survive between calls, so worker threads of later simulations
+ * reuse the engines and buffers of the previous ones.
  */
-void Expetiment1()
+SimulationContext *AcquireContext()
 {
-    const int NUMBER_OF_TEST_SAMPLES = 21;
-
-    // data from tables
-    double CTDA_VALS []= {2.8346, 2.907, 2.9342, 2.8936, 2.9046, 2.8971, 2.8378,
-                          2.8432, 2.8342,2.9032, 2.9178, 2.8190, 2.8772, 2.8100,
-                          2.9328, 2.8477, 2.8342,2.8146, 2.9055, 2.8418, 2.9181};
-
-    double CTWB_VALS []= {6.1796, 6.3721, 6.1890, 6.3850, 6.2920, 6.2297, 6.2860,
-                          6.1901, 6.2720, 6.1126, 6.3301, 6.1450, 6.3021, 6.2378,
-                          6.2891, 6.3310, 6.3187, 6.1722, 6.1137, 6.2671, 6.1263};
-                          
-    double CTPC_VALS []= {1.0199, 0.9977, 1.0288, 0.9880, 1.0186, 0.9883, 1.0078,
-                          1.0079, 0.9220, 1.0260, 1.0348, 0.9972, 1.0152, 1.020,
-                          0.9973, 1.0256, 1.0200, 1.0450, 1.0123, 1.0150, 1.0190};
-
-    int DDDA_VALS []= {2241, 3190, 2845, 3986, 4097, 3967, 2988,
-                       3990, 4010, 3720, 2899, 2690, 2477, 3320,
-                       3966, 4210, 3277, 3547, 4177, 4091, 2851};
-
-    int DDWB_VALS []= {1599, 1987, 2366, 1822, 1769, 2544, 1479,
-                       2265, 2740, 1608, 1790, 2011, 2390, 2700,
-                       2541, 1922, 2410, 2180, 2419, 2655, 2399};
-
-    int DFDA_VALS []= {1601, 2067, 1339, 1845, 1937, 2080, 2065,
-                       1205, 1580, 1945, 1540, 1766, 2010, 2087,
-                       2019, 1579, 1368, 1392, 1752, 2180, 1611};
-
-    int DFWB_VALS []= {1790, 1544, 1988, 1756, 2147, 2079, 1655,
-                       1742, 1823, 2009, 1990, 2080, 1590, 1630,
-                       1762, 1934, 2076, 1855, 1988, 1628, 2070};
-
-    int STDA_VALS []= {3867, 3099, 5427, 4635, 4906, 3782, 3056,
-                       4932, 5109, 3550, 5742, 5230, 4480, 5020,
-                       5564, 5716, 4288, 4399, 4980, 5927, 3899};
-
-    int STWB_VALS []= {2613, 2561, 1762, 2611, 2701, 1677, 1577,
-                       2430, 2054, 2689, 2090, 2190, 1988, 1420,
-                       1436, 1788, 1867, 2090, 1645, 2654, 2017};
-
-    long TTOTAL_VALS []= {994433, 992858, 979236, 980697, 981625, 980148, 993847,
-                          975787, 975532, 984679, 977745, 979935, 984775, 981757,
-                          993745, 994579, 1002224,999328, 994918, 994747, 1005139};
-
-    long OM_VALS []= {72902, 91956, 92674, 82019, 80998, 92276, 76479,
-                      90772, 78789, 80136, 89995, 75844, 72967, 79716,
-                      81412, 72110, 90693, 70974, 72538, 78620, 92051};
-
-    // calculating table means
-    double ctda_mean = 0;
-    double ctwb_mean = 0;
-    double ctpc_mean = 0;
-    double ddda_mean = 0;
-    double ddwb_mean = 0;
-    double dfda_mean = 0;
-    double dfwb_mean = 0;
-    double stda_mean = 0;
-    double stwb_mean = 0;
-    long ttotal_mean = 0;
-    long om_mean = 0;
-    for (int i = 0; i < NUMBER_OF_TEST_SAMPLES; i++)
-    {
-        ctda_mean += CTDA_VALS[i];
-        ctwb_mean += CTWB_VALS[i];
-        ctpc_mean += CTPC_VALS[i];
-        ddda_mean += DDDA_VALS[i];
-        ddwb_mean += DDWB_VALS[i];
-        dfda_mean += DFDA_VALS[i];
-        dfwb_mean += DFWB_VALS[i];
-        stda_mean += STDA_VALS[i];
-        stwb_mean += STWB_VALS[i];
-        ttotal_mean += TTOTAL_VALS[i];
-        om_mean += OM_VALS[i];
-    }
-    ctda_mean /= NUMBER_OF_TEST_SAMPLES;
-    ctwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    ctpc_mean /= NUMBER_OF_TEST_SAMPLES;
-    ddda_mean /= NUMBER_OF_TEST_SAMPLES;
-    ddwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    dfda_mean /= NUMBER_OF_TEST_SAMPLES;
-    dfwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    stda_mean /= NUMBER_OF_TEST_SAMPLES;
-    stwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    ttotal_mean /= NUMBER_OF_TEST_SAMPLES;
-    om_mean /= NUMBER_OF_TEST_SAMPLES;
-    
-    //calculating table standart deviations
-    double ctda_sd = 0;
-    double ctwb_sd = 0;
-    double ctpc_sd = 0;
-    double ddda_sd = 0;
-    double ddwb_sd = 0;
-    double dfda_sd = 0;
-    double dfwb_sd = 0;
-    double stda_sd = 0;
-    double stwb_sd = 0;
-    long ttotal_sd = 0;
-    long om_sd = 0;
-    for (int n = 0; n < NUMBER_OF_TEST_SAMPLES; n++ )
+    std::lock_guard<std::mutex> lock(contextPoolMutex);
+    SimulationContext *context;
+    if (contextPool.empty())
     {
-        ctda_sd += (CTDA_VALS[n] - ctda_mean) * (CTDA_VALS[n] - ctda_mean);
-        ctwb_sd += (CTWB_VALS[n] - ctwb_mean) * (CTWB_VALS[n] - ctwb_mean);
-        ctpc_sd += (CTPC_VALS[n] - ctpc_mean) * (CTPC_VALS[n] - ctpc_mean);
-        ddda_sd += (DDDA_VALS[n] - ddda_mean) * (DDDA_VALS[n] - ddda_mean);
-        ddwb_sd += (DDWB_VALS[n] - ddwb_mean) * (DDWB_VALS[n] - ddwb_mean);
-        dfda_sd += (DFDA_VALS[n] - dfda_mean) * (DFDA_VALS[n] - dfda_mean);
-        dfwb_sd += (DFWB_VALS[n] - dfwb_mean) * (DFWB_VALS[n] - dfwb_mean);
-        stda_sd += (STDA_VALS[n] - stda_mean) * (STDA_VALS[n] - stda_mean);
-        stwb_sd += (STWB_VALS[n] - stwb_mean) * (STWB_VALS[n] - stwb_mean);
-        ttotal_sd += (TTOTAL_VALS[n] - ttotal_mean) * (TTOTAL_VALS[n] - ttotal_mean);
-        om_sd += (OM_VALS[n] - om_mean) * (OM_VALS[n] - om_mean);
+        context = new SimulationContext(modelParameters);
+        context->generation = modelGeneration;
     }
-    ctda_sd = sqrt(ctda_sd / NUMBER_OF_TEST_SAMPLES);
-    ctwb_sd = sqrt(ctwb_sd / NUMBER_OF_TEST_SAMPLES);
-    ctpc_sd = sqrt(ctpc_sd / NUMBER_OF_TEST_SAMPLES);
-    ddda_sd = sqrt(ddda_sd / NUMBER_OF_TEST_SAMPLES);
-    ddwb_sd = sqrt(ddwb_sd / NUMBER_OF_TEST_SAMPLES);
-    dfda_sd = sqrt(dfda_sd / NUMBER_OF_TEST_SAMPLES);
-    dfwb_sd = sqrt(dfwb_sd / NUMBER_OF_TEST_SAMPLES);
-    stda_sd = sqrt(stda_sd / NUMBER_OF_TEST_SAMPLES);
-    stwb_sd = sqrt(stwb_sd / NUMBER_OF_TEST_SAMPLES);
-    ttotal_sd = sqrt(ttotal_sd / NUMBER_OF_TEST_SAMPLES);
-    om_sd = sqrt(om_sd / NUMBER_OF_TEST_SAMPLES);
-
-    // generating random values
-    NormalDistribution CTwb(6.0902, 6.4609);  // Cycle Time Wire Bond
-    NormalDistribution CTda(2.8072, 2.9460);  // Cycle Time Die Attach
-    NormalDistribution CTpc(0.9882, 1.0498);  // Cycle Time Pre-Cap Inspection
-    ExponentialDistribution DDda(2141, 4391); // Downtime Duration Die Attach
-    ExponentialDistribution DDwb(1364, 2797); // Downtime Duration Wire Bond
-    ExponentialDistribution DFda(1066, 2187); // Downtime Frequency Die Attach
-    ExponentialDistribution DFwb(1421, 2193); // Downtime Frequency Wire Bond
-    ExponentialDistribution STda(2957, 6063); // Setup Time Die Attach
-    ExponentialDistribution STwb (1324, 2714);// Setup Time Wire Bond
-
-    // calculating model simulation means
-    double test_ctda_mean = 0;
-    double test_ctwb_mean = 0;
-    double test_ctpc_mean = 0;
-    double test_ddda_mean = 0;
-    double test_ddwb_mean = 0;
-    double test_dfda_mean = 0;
-    double test_dfwb_mean = 0;
-    double test_stda_mean = 0;
-    double test_stwb_mean = 0;
-    long test_ttotal_mean = 0;
-    long test_om_mean = 0;
-
-    double ctda_array [NUMBER_OF_TEST_SAMPLES];
-    double ctwb_array [NUMBER_OF_TEST_SAMPLES];
-    double ctpc_array [NUMBER_OF_TEST_SAMPLES];
-    double ddda_array [NUMBER_OF_TEST_SAMPLES];
-    double ddwb_array [NUMBER_OF_TEST_SAMPLES];
-    double dfda_array [NUMBER_OF_TEST_SAMPLES];
-    double dfwb_array [NUMBER_OF_TEST_SAMPLES];
-    double stda_array [NUMBER_OF_TEST_SAMPLES];
-    double stwb_array [NUMBER_OF_TEST_SAMPLES];
-    long ttotal_array [NUMBER_OF_TEST_SAMPLES];
-    long om_array [NUMBER_OF_TEST_SAMPLES];
-
-    for (int i = 0; i < NUMBER_OF_TEST_SAMPLES; i++)
+    else
     {
-        ctda_array[i] = CTda();
-        test_ctda_mean += ctda_array[i];
-        ctwb_array[i] = CTwb();
-        test_ctwb_mean += ctwb_array[i];
-        ctpc_array[i] = CTpc();
-        test_ctpc_mean += ctpc_array[i];
-        ddda_array[i] = DDda();
-        test_ddda_mean += ddda_array[i];
-        ddwb_array[i] = DDwb();
-        test_ddwb_mean += ddwb_array[i] ;
-        dfda_array[i] = DFda();
-        test_dfda_mean +=  dfda_array[i];
-        dfwb_array[i] = DFwb();
-        test_dfwb_mean += dfwb_array[i];
-        stda_array[i] = STda();
-        test_stda_mean += stda_array[i];
-        stwb_array[i] = STwb();
-        test_stwb_mean += stwb_array[i];
-
-        int Td = 24*60*60; int M= 3;
-        ttotal_array[i] = ( (Td-STda())*((86400-DDda())/86400) + Td +(Td-STwb())*((86400-DDwb())/86400)+Td ) * M;
-        test_ttotal_mean += ttotal_array[i];
-
-        Factory *factory = new Factory();
-        om_array[i] = factory->SimulateTime();
-        test_om_mean += om_array[i];
+        context = contextPool.back().release();
+        contextPool.pop_back();
     }
-    test_ctda_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_ctwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_ctpc_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_ddda_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_ddwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_dfwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_dfda_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_stda_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_stwb_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_ttotal_mean /= NUMBER_OF_TEST_SAMPLES;
-    test_om_mean /= NUMBER_OF_TEST_SAMPLES;
-
-    // calculating model simulation standart deviations
-    double test_ctda_sd = 0;
-    double test_ctwb_sd = 0;
-    double test_ctpc_sd = 0;
-    double test_ddda_sd = 0;
-    double test_ddwb_sd = 0;
-    double test_dfda_sd = 0;
-    double test_dfwb_sd = 0;
-    double test_stda_sd = 0;
-    double test_stwb_sd = 0;
-    long test_ttotal_sd = 0;
-    long test_om_sd = 0;
-    for (int n = 0; n < NUMBER_OF_TEST_SAMPLES; n++ )
+    if (context->generation != modelGeneration)
     {
-        test_ctda_sd += (ctda_array[n] - test_ctda_mean) * (ctda_array[n] - test_ctda_mean);
-        test_ctwb_sd += (ctwb_array[n] - test_ctwb_mean) * (ctwb_array[n] - test_ctwb_mean);
-        test_ctpc_sd += (ctpc_array[n] - test_ctpc_mean) * (ctpc_array[n] - test_ctpc_mean);
-        test_ddda_sd += (ddda_array[n] - test_ddda_mean) * (ddda_array[n] - test_ddda_mean);
-        test_ddwb_sd += (ddwb_array[n] - test_ddwb_mean) * (ddwb_array[n] - test_ddwb_mean);
-        test_dfda_sd += (dfda_array[n] - test_dfda_mean) * (dfda_array[n] - test_dfda_mean);
-        test_dfwb_sd += (dfwb_array[n] - test_dfwb_mean) * (dfwb_array[n] - test_dfwb_mean);
-        test_stda_sd += (stda_array[n] - test_stda_mean) * (stda_array[n] - test_stda_mean);
-        test_stwb_sd += (stwb_array[n] - test_stwb_mean) * (stwb_array[n] - test_stwb_mean);
-        test_ttotal_sd += (ttotal_array[n] - test_ttotal_mean) * (ttotal_array[n] - test_ttotal_mean);
-        test_om_sd += (om_array[n] - test_om_mean) * (om_array[n] - test_om_mean);
+        context->Configure(modelParameters);
+        context->generation = modelGeneration;
     }
-    test_ctda_sd = sqrt(test_ctda_sd / NUMBER_OF_TEST_SAMPLES);
-    test_ctwb_sd = sqrt(test_ctwb_sd / NUMBER_OF_TEST_SAMPLES);
-    test_ctpc_sd = sqrt(test_ctpc_sd / NUMBER_OF_TEST_SAMPLES);
-    test_ddda_sd = sqrt(test_ddda_sd / NUMBER_OF_TEST_SAMPLES);
-    test_ddwb_sd = sqrt(test_ddwb_sd / NUMBER_OF_TEST_SAMPLES);
-    test_dfda_sd = sqrt(test_dfda_sd / NUMBER_OF_TEST_SAMPLES);
-    test_dfwb_sd = sqrt(test_dfwb_sd / NUMBER_OF_TEST_SAMPLES);
-    test_stda_sd = sqrt(test_stda_sd / NUMBER_OF_TEST_SAMPLES);
-    test_stwb_sd = sqrt(test_stwb_sd / NUMBER_OF_TEST_SAMPLES);
-    test_ttotal_sd = sqrt(test_ttotal_sd / NUMBER_OF_TEST_SAMPLES);
-    test_om_sd = sqrt(test_om_sd / NUMBER_OF_TEST_SAMPLES);
-
-
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
-    cout << "Experiment 1 - validacia modelu:" << endl << endl;
-    cout << "Expected CTDA mean: " << ctda_mean << "\tour: " <<  test_ctda_mean << "\tdiff: " << abs(ctda_mean - test_ctda_mean) <<  endl;
-    cout << "Expected CTDA sd  : " << ctda_sd << "\tour: " <<  test_ctda_sd << "\tdiff: " << abs(ctda_sd - test_ctda_sd) <<  endl << endl;
-
-    cout << "Expected CTWB mean: " << ctwb_mean << "\tour: " <<  test_ctwb_mean << "\tdiff: " << abs(ctwb_mean - test_ctwb_mean) <<  endl;
-    cout << "Expected CTWB sd  : " << ctwb_sd << "\tour: " <<  test_ctwb_sd << "\tdiff: " << abs(ctwb_sd - test_ctwb_sd) <<  endl << endl;
-
-    cout << "Expected CTPC mean: " << ctpc_mean << "\tour: " <<  test_ctpc_mean << "\tdiff: " << abs(ctpc_mean - test_ctpc_mean) <<  endl;
-    cout << "Expected CTPC sd  : " << ctpc_sd << "\tour: " <<  test_ctpc_sd << "\tdiff: " << abs(ctpc_sd - test_ctpc_sd) <<  endl << endl;
-
-    cout << "Expected DDDA mean: " << ddda_mean << "\tour: " <<  test_ddda_mean << "\tdiff: " << abs(ddda_mean - test_ddda_mean) <<  endl;
-    cout << "Expected DDDA sd  : " << ddda_sd << "\tour: " <<  test_ddda_sd << "\tdiff: " << abs(ddda_sd - test_ddda_sd) <<  endl << endl;
-
-    cout << "Expected DDWB mean: " << ddwb_mean << "\tour: " <<  test_ddwb_mean << "\tdiff: " << abs(ddwb_mean - test_ddwb_mean) <<  endl;
-    cout << "Expected DDWB sd  : " << ddwb_sd << "\tour: " <<  test_ddwb_sd << "\tdiff: " << abs(ddwb_sd - test_ddwb_sd) <<  endl << endl;
+    return context;
+}
 
-    cout << "Expected DFDA mean: " << dfda_mean << "\tour: " <<  test_dfda_mean << "\tdiff: " << abs(dfda_mean - test_dfda_mean) <<  endl;
-    cout << "Expected DFDA sd  : " << dfda_sd << "\tour: " <<  test_dfda_sd << "\tdiff: " << abs(dfda_sd - test_dfda_sd) <<  endl << endl;
+/**
+ * @brief Returns context taken by AcquireContext to the shared pool
+ */
+void ReleaseContext(SimulationContext *context)
+{
+    std::lock_guard<std::mutex> lock(contextPoolMutex);
+    contextPool.push_back(std::unique_ptr<SimulationContext>(context));
+}
 
-    cout << "Expected DFWB mean: " << dfwb_mean << "\tour: " <<  test_dfwb_mean << "\tdiff: " << abs(dfwb_mean - test_dfwb_mean) <<  endl;
-    cout << "Expected DFWB sd  : " << dfwb_sd << "\tour: " <<  test_dfwb_sd << "\tdiff: " << abs(dfwb_sd - test_dfwb_sd) <<  endl << endl;
+unsigned workerThreads = 0;
 
-    cout << "Expected STDA mean: " << stda_mean << "\tour: " <<  test_stda_mean << "\tdiff: " << abs(stda_mean - test_stda_mean) <<  endl;
-    cout << "Expected STDA sd  : " << stda_sd << "\tour: " <<  test_stda_sd << "\tdiff: " << abs(stda_sd - test_stda_sd) <<  endl << endl;
+/**
+ * @brief Number of workers used for @p count items, 0 @p threads means workerThreads or one per core
+ */
+unsigned WorkerCount(int count, unsigned threads)
+{
+    if (threads == 0)
+        threads = workerThreads;
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+        if (threads == 0)
+            threads = 1;
+    }
+    if ((unsigned)count < threads)
+        threads = count > 0 ? count : 1;
+    return threads;
+}
 
-    cout << "Expected STWB mean: " << stwb_mean << "\tour: " <<  test_stwb_mean << " diff: " << abs(stwb_mean - test_stwb_mean) <<  endl;
-    cout << "Expected STWB sd  : " << stwb_sd << "\tour: " <<  test_stwb_sd << " diff: " << abs(stwb_sd - test_stwb_sd) <<  endl << endl;
+WorkerPool workerPool;
 
+WorkerPool::WorkerPool():
+    task(NULL), generation(0), tasks(0), remaining(0), stopping(false)
+{
+}
 
-    cout << "Expected Ttotal mean: " << ttotal_mean << "\tour: " <<  test_ttotal_mean << "\tdiff: " << abs(ttotal_mean - test_ttotal_mean) <<  endl;
-    cout << "Expected Ttotal sd  : " << ttotal_sd << "\tour: " <<  test_ttotal_sd << "\tdiff: " << abs(ttotal_sd - test_ttotal_sd) <<  endl << endl;
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
 
-    cout << "Expected Om mean: " << om_mean << "\tour: " <<  test_om_mean << "\tdiff: " << abs(om_mean - test_om_mean) <<  endl;
-    cout << "Expected Om sd  : " << om_sd << "\tour: " <<  test_om_sd << "\tdiff: " << abs(om_sd - test_om_sd) <<  endl;
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+void WorkerPool::Run(unsigned threads, const std::function<void(unsigned)> &task)
+{
+    if (threads == 0)
+        return;
+    std::lock_guard<std::mutex> running(runMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (this->threads.size() + 1 < threads)
+            this->threads.push_back(std::thread(&WorkerPool::Loop, this, (unsigned)this->threads.size()));
+        this->task = &task;
+        tasks = threads;
+        remaining = threads - 1;
+        generation++;
+    }
+    wake.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return remaining == 0; });
 }
 
+/**
+ * @brief Body of pool thread @p index, waits for loops and runs task index + 1 of those that have it
+ */
+void WorkerPool::Loop(unsigned index)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    unsigned seen = 0;
+    while (true)
+    {
+        wake.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        if (index + 1 >= tasks)
+            continue;
+        lock.unlock();
+        (*task)(index + 1);
+        lock.lock();
+        if (--remaining == 0)
+            done.notify_one();
+    }
+}
 
 /**
- * @brief Calculates number of factories needed to manufacture 1.14 trilion semiconductors
- * 
+ * @brief Simulates @p count factories on the worker threads of workerPool
+ *
+ * The factories are split evenly between @p threads workers, every worker
+ * simulates its range with its own random engine and the partial sums are
+ * added together at the end. Factories are identified by @p stream and
+ * their index, so the result does not depend on the number of threads.
+ *
+ * @param size size of factory (m)
+ * @param count count of facotries to be simulated
+ * @param time time, the factories will be working [sec]
+ * @param outputs if not NULL, receives production of every single factory
+ * @param stream stream the factories are drawn from
+ * @param first index of the first factory in the stream
+ * @param method way how production of a factory is computed
+ * @param threads number of worker threads, 0 means one per core
+ * @return number of semiconductors per @p time from all @p count factories
  */
-void Expetiment2()
+long SimulateFactories(int size, int count, int time, long *outputs, uint32_t stream, uint32_t first,
+                       Method method, unsigned threads)
 {
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
-    cout << "Experiment 2 - kolko modelovych fabrik je treba na to aby zabezpecili vyrobu za rok 2021:" << endl << endl;
-    #define TOTAL_2021 1140000000000 // 1.14 trilion semiconductors manufactured during year 2021
-    const int numberOfRuns = 10;
-    int averageFactoriesCount = 0;
+    ScopedTimer timer(SIMULATE_FACTORIES);
+    Count(method == DISCRETE_EVENT ? EVENT_FACTORIES : REGRESSION_FACTORIES, count);
+    threads = WorkerCount(count, threads);
+    std::vector<long> partial(threads, 0);
+    RunWorkers(count, threads, [=, &partial](int begin, int end, unsigned t)
+    {
+        SimulationContext *context = AcquireContext();
+        Factory factory(size, time);
+        long num = 0;
+        for (int i = begin ; i < end ; i += SimulationContext::BATCH_SIZE)
+        {
+            int n = std::min(SimulationContext::BATCH_SIZE, end - i);
+            if (method == DISCRETE_EVENT)
+            {
+                for (int k = 0; k < n; k++)
+                    context->Om[k] = factory.SimulateEvents(*context, stream, first + i + k);
+            }
+            else
+            {
+                factory.SimulateBatch(*context, stream, first + i, context->Om, n);
+            }
+            for (int k = 0; k < n; k++)
+                num += context->Om[k];
+            if (outputs)
+                std::copy(context->Om, context->Om + n, outputs + i);
+        }
+        partial[t] = num;
+        ReleaseContext(context);
+    });
+
+    long num = 0;
+    for (unsigned t = 0; t < threads; t++)
+        num += partial[t];
+    return num;
+}
 
-    for (int i = 0; i < numberOfRuns; i++) // average of 10 runs
+long long FactoryFleet::Simulate(int horizon, long *outputs, uint32_t stream, Method method, unsigned threads) const
+{
+    ScopedTimer timer(SIMULATE_FACTORIES);
+    int count = Size();
+    Count(method == DISCRETE_EVENT ? EVENT_FACTORIES : REGRESSION_FACTORIES, count);
+    threads = WorkerCount(count, threads);
+    std::vector<long long> partial(threads, 0);
+    RunWorkers(count, threads, [=, &partial](int begin, int end, unsigned t)
     {
-        int factoriesCount = 0;
-        while (true)
+        SimulationContext *context = AcquireContext();
+        double M[SimulationContext::BATCH_SIZE];
+        double Td[SimulationContext::BATCH_SIZE];
+        long long num = 0;
+        for (int i = begin ; i < end ; i += SimulationContext::BATCH_SIZE)
         {
-            long long count = GenerateFactories(3, factoriesCount, 365*24*60*60); // one year
-            if (count > TOTAL_2021)
+            int n = std::min(SimulationContext::BATCH_SIZE, end - i);
+            for (int k = 0; k < n; k++)
             {
-                break;
+                M[k] = machines[i + k];
+                Td[k] = WorkingTime(i + k, horizon);
+            }
+            if (method == DISCRETE_EVENT)
+            {
+                for (int k = 0; k < n; k++)
+                    context->Om[k] = Td[k] > 0 ? context->line.Simulate(stream, i + k, M[k], Td[k]) : 0;
             }
             else
             {
-                factoriesCount += 500; // approximating
+                Factory::SampleBatch(*context, stream, i, n);
+                FactoryModel<PaperModel, 0>::ComputeOutputs(context->samples, M, Td, context->parameters.CToc,
+                                                            context->Om, n);
+                for (int k = 0; k < n; k++)
+                    if (Td[k] <= 0)
+                        context->Om[k] = 0;
             }
+            for (int k = 0; k < n; k++)
+                num += context->Om[k];
+            if (outputs)
+                std::copy(context->Om, context->Om + n, outputs + i);
+        }
+        partial[t] = num;
+        ReleaseContext(context);
+    });
+
+    long long num = 0;
+    for (unsigned t = 0; t < threads; t++)
+        num += partial[t];
+    return num;
+}
+
+/**
+ * @brief Generates size factories with parameters
+ *
+ * @param size size of factory (m)
+ * @param count count of facotries to be generated
+ * @param time time, the factories will be working [sec]
+ * @param stream stream the factories are drawn from
+ * @param threads number of worker threads, 0 means one per core
+ * @return  number of semiconductors per @time from @count facotries of @size 
+ */
+long GenerateFactories(int size, int count, int time, uint32_t stream, unsigned threads)
+{
+    return SimulateFactories(size, count, time, NULL, stream, 0, REGRESSION, threads);
+}
+
+/**
+ * @brief Finds the smallest number of factories that manufacture more than @p target
+ *
+ * Factories are added in galloping steps and only the newly added ones are
+ * simulated, the running total of the fleet is kept between steps. Step
+ * doubles while the target is far away and is capped by the estimate of
+ * the remaining factories from the mean production seen so far and by
+ * MAX_SEARCH_STEP, so memory stays bounded. Once a step crosses the target,
+ * the exact count is found by bisection over the prefix sums of that step.
+ *
+ * @param size size of factory (m)
+ * @param time time, the factories will be working [sec]
+ * @param target number of semiconductors the fleet has to exceed
+ * @param stream stream the factories are drawn from
+ * @param produced if not NULL, receives production of the found fleet
+ * @param statistics if not NULL, production of every factory of the found fleet is added to it
+ * @param first index of the first factory in the stream
+ * @param outputs if not NULL, production of every factory of the found fleet is appended to it
+ * @param method way how production of the factories is computed
+ * @param limit most factories the answer may have, at most MAX_NEEDED_FACTORIES
+ * @return number of factories needed, -1 when the factories manufacture nothing on average or about
+ *         more than @p limit of them would be needed
+ */
+int FactoriesNeeded(int size, int time, long long target, uint32_t stream, long long *produced,
+                    RunningStatistics *statistics, uint32_t first, std::vector<long> *outputs, Method method,
+                    int limit)
+{
+    ScopedTimer timer(FACTORIES_NEEDED);
+    Count(SEARCHES);
+    int count = 0;
+    long long total = 0;
+    int step = std::min(64, limit);
+    std::vector<long> chunkOutputs;
+
+    while (total <= target)
+    {
+        if (count > 0)
+        {
+            double mean = (double)total / count;
+            double remaining = (target - total) / mean + 1;
+            if (mean <= 0 || count + remaining > limit)
+                return -1;
+            step = std::min<long long>(std::min(2 * step, MAX_SEARCH_STEP), (long long)remaining);
         }
-        averageFactoriesCount += factoriesCount;
+
+        chunkOutputs.resize(step);
+        Count(SEARCH_STEPS);
+        Count(SEARCH_FACTORIES, step);
+        long chunk = SimulateFactories(size, step, time, chunkOutputs.data(), stream, first + count, method);
+        if (total + chunk <= target)
+        {
+            total += chunk;
+            count += step;
+            for (int i = 0; statistics && i < step; i++)
+                statistics->Add(chunkOutputs[i]);
+            if (outputs)
+                outputs->insert(outputs->end(), chunkOutputs.begin(), chunkOutputs.end());
+            continue;
+        }
+
+        // bisection over prefix sums of the step that crossed the target
+        if (outputs)
+            outputs->insert(outputs->end(), chunkOutputs.begin(), chunkOutputs.end());
+        for (int i = 1; i < step; i++)
+            chunkOutputs[i] += chunkOutputs[i - 1];
+        int added = std::upper_bound(chunkOutputs.begin(), chunkOutputs.end(), target - total) - chunkOutputs.begin();
+        for (int i = 0; statistics && i <= added; i++)
+            statistics->Add(i ? chunkOutputs[i] - chunkOutputs[i - 1] : chunkOutputs[0]);
+        if (outputs)
+            outputs->resize(outputs->size() - (step - added - 1));
+        total += chunkOutputs[added];
+        count += added + 1;
     }
-    averageFactoriesCount /= numberOfRuns;
 
-    cout << "1.14 trilion polovodicov vyrobi "<< averageFactoriesCount << " modelovych fabrik za rok." << endl;
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    if (produced)
+        *produced = total;
+    return count;
 }
 
+int CapacityPlanner::Plan(long long demand, RunningStatistics *statistics)
+{
+    int start = years++ * time;
+    if (capacity > demand)
+        return 0;
+    long long produced = 0;
+    size_t known = outputs.size();
+    int built = FactoriesNeeded(size, time, demand - capacity, stream, &produced, NULL, fleet.Size(), &outputs);
+    if (built < 0)
+    {
+        outputs.resize(known); // drop the factories simulated before the search gave up
+        return -1;
+    }
+    for (int i = 0; i < built; i++)
+        fleet.Add(size, start, 24);
+    for (size_t i = known; statistics && i < outputs.size(); i++)
+        statistics->Add(outputs[i]);
+    capacity += produced;
+    return built;
+}
 
 /**
- * @brief Calculates number of factories to be built every year to satisfy the production
- * 
+ * @brief Solves A x = b by Gaussian elimination with partial pivoting, A and b are destroyed
+ *
+ * @return false when A is singular
  */
-void Expetiment3()
+bool SolveLinearSystem(std::vector<std::vector<double> > &A, std::vector<double> &b, std::vector<double> &x)
+{
+    int n = b.size();
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+            if (std::fabs(A[row][col]) > std::fabs(A[pivot][col]))
+                pivot = row;
+        if (A[pivot][col] == 0)
+            return false;
+        std::swap(A[col], A[pivot]);
+        std::swap(b[col], b[pivot]);
+        for (int row = col + 1; row < n; row++)
+        {
+            double f = A[row][col] / A[col][col];
+            for (int k = col; k < n; k++)
+                A[row][k] -= f * A[col][k];
+            b[row] -= f * b[col];
+        }
+    }
+    x.assign(n, 0);
+    for (int row = n - 1; row >= 0; row--)
+    {
+        double sum = b[row];
+        for (int k = row + 1; k < n; k++)
+            sum -= A[row][k] * x[k];
+        x[row] = sum / A[row][row];
+    }
+    return true;
+}
+
+const int OutputEstimator::K;
+
+OutputEstimator::OutputEstimator(int size, int time, uint32_t stream, VarianceReduction reduction):
+    size(size), time(time), stream(stream), reduction(reduction), factories(0)
 {
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
-    cout << "Experiment 3 - kolko je treba vybudovat modelovych fabrik rocne aby to stacilo prirodzenemu rastu vyroby (6.25%):" << endl << endl;
-    #define TOTAL_2021 1140000000000 // 1.14 trilion semiconductors manufactured during year 2021
-    const int numberOfRuns = 10;
-    long totalByNYears = TOTAL_2021; 
+}
 
-    for(int year = 1 ; year < 6 ; year++) // next 5 years
+void OutputEstimator::Add(int count, unsigned threads)
+{
+    ScopedTimer timer(ESTIMATE_MEAN_OUTPUT);
+    struct Sums
+    {
+        double y, yy, pair, pairpair;
+        double x[K], xx[K][K], xy[K];
+    };
+
+    // factories are summed in fixed blocks which are combined in their order,
+    // so the estimate does not depend on how the blocks are split between threads
+    const int BLOCK = SimulationContext::BATCH_SIZE;
+    const uint32_t first = factories;
+    const bool antithetic = reduction == ANTITHETIC, controls = reduction == CONTROL_VARIATES;
+    const int size = this->size, time = this->time;
+    const uint32_t stream = this->stream;
+    int pairs = (count + 1) / 2;
+    int blocks = (2 * pairs + BLOCK - 1) / BLOCK;
+    Count(REGRESSION_FACTORIES, 2L * pairs);
+    threads = WorkerCount(blocks, threads);
+    std::vector<Sums> partial(blocks);
+    std::vector<RunningStatistics> outputs(blocks);
+    RunWorkers(blocks, threads, [=, &partial, &outputs](int begin, int end, unsigned)
     {
-        int averageFactoriesCount = 0;
-        int averageCount = 0;
-        for (int i = 0; i < numberOfRuns; i++) // average of 10
+        SimulationContext *context = AcquireContext();
+        const FactorySamples &samples = context->samples;
+        Factory factory(size, time);
+        double means[K];
+        for (int p = 0; p < K; p++)
+            means[p] = context->InputMean(p);
+
+        for (int block = begin; block < end; block++)
         {
-            int factoriesCount = 0;
-            long rise = (totalByNYears / 100) * 6.25;
-            long long count = 0;
-            while (true)
+            int i = block * BLOCK;
+            int n = std::min(BLOCK, 2 * pairs - i);
+            Sums &sums = partial[block];
+            memset(&sums, 0, sizeof(sums));
+            factory.SimulateBatch(*context, stream, first + i, context->Om, n, antithetic);
+            for (int k = 0; k < n; k++)
             {
-                count = GenerateFactories(3, factoriesCount, 365*60*60*24); // one year
-                if (count > rise) // 6.25 % from previous year
+                double y = context->Om[k];
+                outputs[block].Add(y);
+                sums.y += y;
+                sums.yy += y * y;
+                if (k % 2 == 1)
                 {
-                    break;
+                    double pair = (context->Om[k - 1] + y) / 2;
+                    sums.pair += pair;
+                    sums.pairpair += pair * pair;
                 }
-                else
+                if (!controls)
+                    continue;
+                double x[K];
+                for (int p = 0; p < PARAMETER_COUNT; p++)
+                    x[p] = samples.values[p][k] - means[p];
+                x[PARAMETER_COUNT] = samples.Q[k] - means[PARAMETER_COUNT];
+                for (int p = 0; p < K; p++)
                 {
-                    factoriesCount += 50; // approximating
+                    sums.x[p] += x[p];
+                    sums.xy[p] += x[p] * y;
+                    for (int r = 0; r <= p; r++)
+                        sums.xx[p][r] += x[p] * x[r];
                 }
             }
-            averageFactoriesCount += factoriesCount;
-            averageCount += count;
         }
-        averageFactoriesCount /= numberOfRuns;
-        averageCount /= numberOfRuns;
-        
-        cout << "po "<< year <<" rokoch, pocet fabrik potrebny vybudovat aby sa stihala vyroba:"<< averageFactoriesCount << endl;
-    
-        totalByNYears = totalByNYears + averageCount;
+        ReleaseContext(context);
+    });
+
+    for (int block = 0; block < blocks; block++)
+    {
+        output.Merge(outputs[block]);
+        y.Add(partial[block].y);
+        yy.Add(partial[block].yy);
+        pair.Add(partial[block].pair);
+        pairpair.Add(partial[block].pairpair);
+        for (int p = 0; p < K; p++)
+        {
+            x[p].Add(partial[block].x[p]);
+            xy[p].Add(partial[block].xy[p]);
+            for (int r = 0; r <= p; r++)
+                xx[p][r].Add(partial[block].xx[p][r]);
+        }
     }
-    cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
+    factories += 2L * pairs;
 }
 
-
-int main(int argc, char *argv[])
+/**
+ * @brief Estimates mean production of one factory using the selected variance reduction
+ *
+ * Plain mode averages the factories. Antithetic mode averages the means of
+ * the mirrored pairs of factories. Control variates mode regresses the
+ * production on every sampled input and the batch size, whose expected
+ * values are known, and removes the part explained by their deviation from
+ * the expected values.
+ */
+OutputEstimate OutputEstimator::Estimate() const
 {
-
-    bool one = false;
-    bool two = false;
-    bool three = false;
-    for (int i = 1 ; i < argc; i++)
+    OutputEstimate estimate;
+    estimate.output = output;
+    double n = factories;
+    long pairs = factories / 2;
+    estimate.factories = factories;
+    estimate.mean = y.Value() / n;
+    double variance = yy.Value() / n - estimate.mean * estimate.mean;
+    estimate.plainStandardError = std::sqrt(variance / n);
+    estimate.standardError = estimate.plainStandardError;
+
+    if (reduction == ANTITHETIC)
     {
-        if (strcmp(argv[i], "-1") == 0)
-        {
-            one = true;
-        }
-        else if (strcmp(argv[i], "-2") == 0)
-        {
-            two = true;
-        }
-        else if (strcmp(argv[i], "-3") == 0)
+        double pairMean = pair.Value() / pairs;
+        double pairVariance = pairpair.Value() / pairs - pairMean * pairMean;
+        estimate.mean = pairMean;
+        estimate.standardError = std::sqrt(pairVariance / pairs);
+    }
+    else if (reduction == CONTROL_VARIATES)
+    {
+        std::vector<std::vector<double> > covariance(K, std::vector<double>(K));
+        std::vector<double> cross(K), beta;
+        for (int p = 0; p < K; p++)
         {
-            three = true;
+            for (int r = 0; r <= p; r++)
+            {
+                covariance[p][r] = xx[p][r].Value() / n - (x[p].Value() / n) * (x[r].Value() / n);
+                covariance[r][p] = covariance[p][r];
+            }
+            cross[p] = xy[p].Value() / n - (x[p].Value() / n) * estimate.mean;
         }
-        else
+        std::vector<double> crossCopy = cross;
+        if (SolveLinearSystem(covariance, crossCopy, beta))
         {
-            cout << "Usage : ./simualtion [-1] [-2] [-3]" << endl;
-            return 1;
+            double explained = 0;
+            for (int p = 0; p < K; p++)
+            {
+                estimate.mean -= beta[p] * x[p].Value() / n;
+                explained += beta[p] * cross[p];
+            }
+            double residual = (variance - explained) * n / (n - K - 1);
+            estimate.standardError = std::sqrt(std::max(residual, 0.0) / n);
         }
     }
-    if (one || argc == 1) Expetiment1();
-    if (two || argc == 1) Expetiment2();
-    if (three || argc == 1) Expetiment3();
-
-    return 0;
-}
\ No newline at end of file
+    return estimate;
+}
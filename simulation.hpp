@@ -0,0 +1,1755 @@
+/**
+ * @file simulation.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Model of the semiconductor factory and its parallel simulation,
+ *          shared by the experiments and the benchmarks
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "metrics.hpp"
+#include "reduction.hpp"
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+typedef std::chrono::high_resolution_clock myclock;
+
+extern uint64_t simulationSeed; // seed of every random engine, set by --seed or randomly at startup
+
+/**
+ * @brief Counter-based random engine (Philox4x32-10)
+ *
+ * Every output is a function of the seed and a 128 bit counter only, so
+ * any position of any stream can be reached in O(1) by Seek. Counter is
+ * split to the draw number, the model parameter, the factory index and
+ * the stream, so the samples of "factory i, parameter j" do not depend on
+ * which thread or in which order the factory is simulated.
+ */
+class PhiloxEngine
+{
+    uint32_t key[2];
+    uint32_t counter[4]; // draw, parameter, factory, stream
+    uint32_t block[4];
+    int used;
+    bool complement; // antithetic stream, every output is mirrored
+
+    static void MulHiLo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo)
+    {
+        uint64_t product = (uint64_t)a * b;
+        hi = product >> 32;
+        lo = (uint32_t)product;
+    }
+
+    void Generate()
+    {
+        Block(counter, key, block);
+        counter[0]++;
+        used = 0;
+    }
+
+public:
+    typedef uint64_t result_type;
+
+    /**
+     * @brief Philox4x32-10 block of @p counter under @p key, as published with known answers in Random123
+     */
+    static void Block(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+    {
+        uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; round++)
+        {
+            uint32_t hi0, lo0, hi1, lo1;
+            MulHiLo(0xD2511F53, c[0], hi0, lo0);
+            MulHiLo(0xCD9E8D57, c[2], hi1, lo1);
+            uint32_t next[4] = {hi1 ^ c[1] ^ k0, lo1, hi0 ^ c[3] ^ k1, lo0};
+            std::copy(next, next + 4, c);
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        std::copy(c, c + 4, out);
+    }
+
+    explicit PhiloxEngine(uint64_t seed = 0)
+    {
+        key[0] = (uint32_t)seed;
+        key[1] = seed >> 32;
+        Seek(0, 0, 0);
+    }
+
+    /**
+     * @brief Moves the engine to the beginning of the given stream
+     *
+     * @param stream independent sequence of factories, e.g. one run of an experiment
+     * @param factory index of the factory in the stream
+     * @param parameter index of the random input of the factory
+     * @param antithetic return mirrored numbers (max() - x) of the stream
+     */
+    void Seek(uint32_t stream, uint32_t factory, uint32_t parameter, bool antithetic = false)
+    {
+        counter[0] = 0;
+        counter[1] = parameter;
+        counter[2] = factory;
+        counter[3] = stream;
+        used = 4;
+        complement = antithetic;
+    }
+
+    /**
+     * @brief First uniform number of the streams of factories @p first .. @p first + @p n - 1
+     *
+     * Same numbers as SeekFactory and UniformNumber for every factory, but
+     * the Philox blocks of consecutive factories are computed side by side
+     * with AVX2. The position of the engine is not changed.
+     *
+     * @param antithetic odd factories mirror the stream of the previous even one
+     */
+    void Uniforms(uint32_t stream, uint32_t first, uint32_t parameter, bool antithetic, double *out, int n) const;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator ()()
+    {
+        if (used == 4)
+            Generate();
+        uint64_t number = ((uint64_t)block[used + 1] << 32) | block[used];
+        used += 2;
+        return complement ? ~number : number;
+    }
+};
+
+typedef PhiloxEngine RandomEngine;
+
+/**
+ * @brief Variance reduction used when estimating the mean production of a factory
+ */
+enum VarianceReduction
+{
+    NO_REDUCTION,
+    ANTITHETIC,        // odd factories mirror the random numbers of the previous even one
+    CONTROL_VARIATES   // sampled inputs with known means correct the estimate
+};
+
+void SeekFactory(RandomEngine &generator, uint32_t stream, uint32_t factory, uint32_t parameter, bool antithetic = false);
+double NormalQuantile(double p);
+void TruncateNumbers(double *values, int n, double f);
+
+/**
+ * @brief Uniform number in [0, 1) from the 53 high bits of one output of @p generator
+ *
+ * The mirrored output of an antithetic stream gives 1 - 2^-53 - u.
+ */
+inline double UniformNumber(RandomEngine &generator)
+{
+    return (generator() >> 11) * (1.0 / (1ULL << 53));
+}
+
+/**
+ * @brief Quantile function of a truncated distribution tabulated for sampling without rejection
+ *
+ * The probability [0, 1) is split into KNOTS equal steps; between two knots
+ * the quantile is the cubic Hermite interpolation of its exact values and
+ * slopes at the knots. A uniform number becomes a sample by one
+ * multiplication, one table read and one cubic, the same for every number,
+ * so batches run without branches. The interpolation error is below 1e-9
+ * of the width of the window, far below the 3 digits the samples keep.
+ */
+class QuantileTable
+{
+public:
+    static const int KNOTS = 1024;
+
+    /**
+     * @brief Tabulates @p quantile whose derivative is @p slope, both defined on [0, 1]
+     */
+    template <class Quantile, class Slope>
+    void Build(Quantile quantile, Slope slope)
+    {
+        const double h = 1.0 / KNOTS;
+        coefficients.resize(4 * KNOTS);
+        double y0 = quantile(0.0), m0 = h * slope(0.0);
+        for (int j = 0; j < KNOTS; j++)
+        {
+            double u = (j + 1) * h;
+            double y1 = quantile(u), m1 = h * slope(u);
+            double *c = &coefficients[4 * j];
+            c[0] = y0;
+            c[1] = m0;
+            c[2] = 3 * (y1 - y0) - 2 * m0 - m1;
+            c[3] = 2 * (y0 - y1) + m0 + m1;
+            y0 = y1;
+            m0 = m1;
+        }
+    }
+
+    double operator ()(double u) const {
+        double x = u * KNOTS;
+        int j = (int)x;
+        double t = x - j;
+        const double *c = &coefficients[4 * j];
+        return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+    }
+
+    /**
+     * @brief Replaces every uniform number of @p values by its quantile, four of them at once with AVX2
+     */
+    void Transform(double *values, int n) const;
+
+private:
+    std::vector<double> coefficients; // a + b t + c t^2 + d t^3 of every step
+};
+
+/**
+ * @brief Generates random number in normal distribution
+ *
+ * Normal distribution with the window min..max at mean +- 2 sd, restricted
+ * to the window. Every number is the tabulated inverse distribution function
+ * of one uniform number, so nothing is rejected.
+ */
+class NormalDistribution {
+    double mean;
+    double sd;
+    double min;
+    double max;
+    QuantileTable table;
+    long drawn; // numbers of operator() not yet added to the metrics
+public:
+    NormalDistribution(double min, double max):
+        mean((min + max) / 2), sd((max - min) / 4), min(min), max(max), drawn(0)
+    {
+        double mean = this->mean, sd = this->sd;
+        double low = 0.5 * std::erfc((mean - min) / (sd * M_SQRT2));
+        double high = 0.5 * std::erfc((mean - max) / (sd * M_SQRT2));
+        this->table.Build(
+            [=](double u) { return mean + sd * NormalQuantile(low + u * (high - low)); },
+            [=](double u) {
+                double z = NormalQuantile(low + u * (high - low));
+                return sd * (high - low) * std::sqrt(2 * M_PI) * std::exp(z * z / 2);
+            });
+    }
+
+    /**
+     * @brief Expected value of the generated numbers
+     *
+     * The window is symmetric around the mean, truncation to 3 digits
+     * lowers it by half of the last digit on average.
+     */
+    double Mean() const {
+        return (this->min + this->max) / 2 - 0.0005;
+    }
+
+    /**
+     * @brief Number below which fraction @p u of the generated numbers lies
+     *
+     * Inverse of the distribution function of the window, truncated to 3
+     * digits as the generated numbers, so operator() is Quantile of a
+     * uniform number.
+     */
+    double Quantile(double u) const {
+        return std::trunc(this->table(u) * 1000) / 1000;
+    }
+
+    double operator ()(RandomEngine &generator) {
+        this->drawn++;
+        return Quantile(UniformNumber(generator));
+    }
+
+    /**
+     * @brief Adds the numbers of operator() since the last call to the metrics, call once per factory
+     */
+    void FlushCount() {
+        if (this->drawn == 0)
+            return;
+        Count(NORMAL_SAMPLES, this->drawn);
+        this->drawn = 0;
+    }
+
+    /**
+     * @brief Fills @p out with the numbers of @p n consecutive factories
+     *
+     * Number of the factory @p first + i is drawn from the stream of that
+     * factory and @p parameter, so it is the same whatever batch it is in.
+     * With @p antithetic, odd factories mirror the previous even one.
+     */
+    void Sample(RandomEngine &generator, uint32_t stream, uint32_t first, uint32_t parameter, double *out, int n,
+                bool antithetic = false) {
+        generator.Uniforms(stream, first, parameter, antithetic, out, n);
+        Count(NORMAL_SAMPLES, n);
+        this->table.Transform(out, n);
+        TruncateNumbers(out, n, 1000);
+    }
+};
+
+/**
+ * @brief Generates random number in exponential distribution
+ *
+ * Exponential distribution shifted to min, 95 % of it below max, restricted
+ * to min..max. Every number is the tabulated inverse distribution function
+ * of one uniform number, so nothing is rejected.
+ */
+class ExponentialDistribution {
+    double lambda;
+    double min;
+    double max;
+    QuantileTable table;
+    long drawn; // numbers of operator() not yet added to the metrics
+public:
+    ExponentialDistribution(double min, double max):
+        lambda(1 /((max - min) / (-std::log(0.05)))), min(min), max(max), drawn(0)
+    {
+        double lambda = this->lambda;
+        double mass = 1 - std::exp(-lambda * (max - min)); // probability of the window
+        this->table.Build(
+            [=](double u) { return min - std::log1p(-u * mass) / lambda; },
+            [=](double u) { return mass / (lambda * (1 - u * mass)); });
+    }
+
+    /**
+     * @brief Expected value of the generated numbers
+     *
+     * Mean of the exponential distribution shifted to min and truncated at
+     * max, truncation to 3 digits lowers it by half of the last digit on average.
+     */
+    double Mean() const {
+        double width = this->max - this->min;
+        double tail = std::exp(-this->lambda * width);
+        return this->min + 1 / this->lambda - width * tail / (1 - tail) - 0.0005;
+    }
+
+    /**
+     * @brief Number below which fraction @p u of the generated numbers lies
+     *
+     * Inverse of the distribution function of the window, truncated to 3
+     * digits as the generated numbers, so operator() is Quantile of a
+     * uniform number.
+     */
+    double Quantile(double u) const {
+        return std::trunc(this->table(u) * 1000) / 1000;
+    }
+
+    double operator ()(RandomEngine &generator) {
+        this->drawn++;
+        return Quantile(UniformNumber(generator));
+    }
+
+    /**
+     * @brief Adds the numbers of operator() since the last call to the metrics, call once per factory
+     */
+    void FlushCount() {
+        if (this->drawn == 0)
+            return;
+        Count(EXPONENTIAL_SAMPLES, this->drawn);
+        this->drawn = 0;
+    }
+
+    /**
+     * @brief Fills @p out with the numbers of @p n consecutive factories
+     *
+     * Number of the factory @p first + i is drawn from the stream of that
+     * factory and @p parameter, so it is the same whatever batch it is in.
+     * With @p antithetic, odd factories mirror the previous even one.
+     */
+    void Sample(RandomEngine &generator, uint32_t stream, uint32_t first, uint32_t parameter, double *out, int n,
+                bool antithetic = false) {
+        generator.Uniforms(stream, first, parameter, antithetic, out, n);
+        Count(EXPONENTIAL_SAMPLES, n);
+        this->table.Transform(out, n);
+        TruncateNumbers(out, n, 1000);
+    }
+};
+
+/**
+ * @brief Random inputs of the factory model, one per draw in Factory::SimulateTime
+ *
+ * Ttotal and Tb draw setup and downtime durations separately, so those
+ * parameters have two entries.
+ */
+enum Parameter
+{
+    CTWB, CTDA, CTPC,           // Cycle Times
+    DDDA, DDWB,                 // Downtime Durations in Tb
+    DFDA, DFWB,                 // Downtime Frequencies
+    STDA, STWB,                 // Setup Times in Tb
+    TT_STDA, TT_DDDA,           // Setup Time and Downtime Duration Die Attach in Ttotal
+    TT_STWB, TT_DDWB,           // Setup Time and Downtime Duration Wire Bond in Ttotal
+    PARAMETER_COUNT,
+    BATCH_SIZE_INDEX = PARAMETER_COUNT // stream of the Batch size choice
+};
+
+/**
+ * @brief One term coefficient * (input - center) / scale of the regression of Tb
+ */
+struct RegressionTerm
+{
+    int input;          // Parameter the term depends on
+    double coefficient;
+    double center;
+    double scale;
+};
+
+/**
+ * @brief Regression of Tb, batch sizes and oven cure time of the paper
+ *
+ * Policy of FactoryModel. Another fit of the line is another struct with
+ * the same members, FactoryModel compiles a separate kernel for it.
+ */
+struct PaperModel
+{
+    static constexpr int TERM_COUNT = 9;
+    static constexpr RegressionTerm TERMS[TERM_COUNT] = {   // in the order they are added to CToc
+        {CTDA, 387.1239, 2.8766, 0.0694}, {CTWB, 1008.0011, 6.2756, 0.1854}, {CTPC, 157.9690, 1.019, 0.0308},
+        {DDDA, 9.5167, 3266, 1125}, {DDWB, 3.9325, 2080.5, 716.5}, {DFDA, 2.4477, 1626.5, 560.5},
+        {DFWB, -0.1807, 1807, 386}, {STDA, -2.6148, 4510, 1553}, {STWB, 24.3713, 2019, 695}
+    };
+    static constexpr double BATCH_SIZE_COEFFICIENT = 10.1729;
+    static constexpr int BATCH_SIZES[3] = {2200, 3080, 11264};
+    static constexpr int CTOC = 7200; // Cycle Time Oven Cure
+};
+
+/**
+ * @brief Interval the truncated distribution of an input is limited to
+ */
+struct Bounds
+{
+    double min;
+    double max;
+};
+
+/**
+ * @brief Inputs of the factory model that can be changed without recompiling
+ *
+ * Defaults are the values of the paper. The regression coefficients of Tb
+ * are a fit of the paper's model, so they are not part of the scenario.
+ */
+struct ModelParameters
+{
+    Bounds CTwb, CTda, CTpc;                        // Cycle Times
+    Bounds DDda, DDwb, DFda, DFwb, STda, STwb;      // Downtime Durations, Frequencies and Setup Times
+    int Q[3];                                       // Batch sizes
+    int CToc;                                       // Cycle Time Oven Cure
+
+    ModelParameters():
+        CTwb{6.0902, 6.4609}, CTda{2.8072, 2.9460}, CTpc{0.9882, 1.0498},
+        DDda{2141, 4391}, DDwb{1364, 2797}, DFda{1066, 2187}, DFwb{1421, 2193},
+        STda{2957, 6063}, STwb{1324, 2714}, Q{PaperModel::BATCH_SIZES[0], PaperModel::BATCH_SIZES[1], PaperModel::BATCH_SIZES[2]},
+        CToc(PaperModel::CTOC)
+    {
+    }
+};
+
+extern ModelParameters modelParameters; // model simulated by every context, change by SetModelParameters
+
+/**
+ * @brief Replaces the simulated model, contexts taken from the pool afterwards are reconfigured
+ *
+ * Must not be called while a simulation is running.
+ */
+void SetModelParameters(const ModelParameters &parameters);
+
+/**
+ * @brief Sampled inputs of a batch of factories in structure-of-arrays layout
+ *
+ * values[p][i] is parameter p of the i-th factory, Q[i] its batch size.
+ */
+struct FactorySamples
+{
+    std::vector<double> values[PARAMETER_COUNT];
+    std::vector<double> Q;
+
+    explicit FactorySamples(int capacity = 0)
+    {
+        Resize(capacity);
+    }
+
+    void Resize(int capacity)
+    {
+        for (int p = 0; p < PARAMETER_COUNT; p++)
+            values[p].resize(capacity);
+        Q.resize(capacity);
+    }
+
+    int Capacity() const
+    {
+        return Q.size();
+    }
+};
+
+/**
+ * @brief Future event list of the discrete-event simulation
+ *
+ * Binary heap of indices into a pool of events. Popped events return to the
+ * pool and are reused, so a running simulation does not allocate once the
+ * pool has grown to the largest number of pending events.
+ */
+class EventQueue
+{
+public:
+    struct Event
+    {
+        double time;
+        uint64_t order; // keeps events with equal time in the order they were scheduled
+        int type;
+        int station;
+        int machine;
+    };
+
+    void Clear()
+    {
+        pool.clear();
+        freeEvents.clear();
+        heap.clear();
+        scheduled = 0;
+    }
+
+    bool Empty() const
+    {
+        return heap.empty();
+    }
+
+    double NextTime() const
+    {
+        return pool[heap.front()].time;
+    }
+
+    void Schedule(double time, int type, int station, int machine)
+    {
+        Event event = {time, scheduled++, type, station, machine};
+        int index;
+        if (freeEvents.empty())
+        {
+            index = pool.size();
+            pool.push_back(event);
+        }
+        else
+        {
+            index = freeEvents.back();
+            freeEvents.pop_back();
+            pool[index] = event;
+        }
+        heap.push_back(index);
+        std::push_heap(heap.begin(), heap.end(), Later(pool));
+    }
+
+    Event Pop()
+    {
+        std::pop_heap(heap.begin(), heap.end(), Later(pool));
+        int index = heap.back();
+        heap.pop_back();
+        freeEvents.push_back(index);
+        return pool[index];
+    }
+
+private:
+    struct Later
+    {
+        const std::vector<Event> &pool;
+        explicit Later(const std::vector<Event> &pool): pool(pool) {}
+        bool operator ()(int a, int b) const
+        {
+            if (pool[a].time != pool[b].time)
+                return pool[a].time > pool[b].time;
+            return pool[a].order > pool[b].order;
+        }
+    };
+
+    std::vector<Event> pool;
+    std::vector<int> freeEvents;
+    std::vector<int> heap;
+    uint64_t scheduled = 0;
+};
+
+/**
+ * @brief Columns receiving what one factory of LineSimulator did in every period of its working time
+ *
+ * Period p covers [p * period, (p + 1) * period) seconds, each column has
+ * ceil(Td / period) values and must be zeroed by the caller.
+ */
+struct FactoryTimeline
+{
+    int period;         // length of a period [seconds], e.g. a day or a shift
+    uint32_t *produced; // semiconductors that passed pre-cap inspection
+    float *downtime;    // seconds of breakdowns summed over the machines
+    float *setup;       // seconds of setups summed over the machines
+
+    /**
+     * @brief Adds the part of [from, to) before @p Td to the periods of @p column it overlaps
+     */
+    void AddInterval(float *column, double from, double to, int Td) const
+    {
+        to = std::min(to, (double)Td);
+        while (from < to)
+        {
+            int p = (int)(from / period);
+            double end = std::min(to, (double)(p + 1) * period);
+            column[p] += end - from;
+            from = end;
+        }
+    }
+};
+
+/**
+ * @brief Discrete-event model of the die attach -> oven cure -> wire bond -> pre-cap line
+ *
+ * Every station has M machines sharing one queue of batches of Q pieces.
+ * Die attach and wire bond set up before every batch, process it piece by
+ * piece with the sampled cycle time and break down after Downtime Frequency
+ * minutes for Downtime Duration seconds, a batch being processed during
+ * the breakdown is finished later by that time. Oven cures a whole batch
+ * in CToc, pre-cap inspects it piece by piece. Die attach never runs out of
+ * material. Inputs of factory i are drawn from the same streams as its
+ * inputs in Factory::SimulateBatch, one stream per parameter.
+ */
+class LineSimulator
+{
+public:
+    LineSimulator(uint64_t seed, const ModelParameters &parameters):
+        CTwb(parameters.CTwb.min, parameters.CTwb.max), CTda(parameters.CTda.min, parameters.CTda.max),
+        CTpc(parameters.CTpc.min, parameters.CTpc.max), DDda(parameters.DDda.min, parameters.DDda.max),
+        DDwb(parameters.DDwb.min, parameters.DDwb.max), DFda(parameters.DFda.min, parameters.DFda.max),
+        DFwb(parameters.DFwb.min, parameters.DFwb.max), STda(parameters.STda.min, parameters.STda.max),
+        STwb(parameters.STwb.min, parameters.STwb.max), QIndex(0, 2), parameters(parameters), Td(0), timeline(NULL)
+    {
+        for (int p = 0; p <= PARAMETER_COUNT; p++)
+            engines[p] = RandomEngine(seed);
+    }
+
+    /**
+     * @brief Rebuilds the distributions for another model, engines and event pool are kept
+     */
+    void Configure(const ModelParameters &parameters)
+    {
+        CTwb = NormalDistribution(parameters.CTwb.min, parameters.CTwb.max);
+        CTda = NormalDistribution(parameters.CTda.min, parameters.CTda.max);
+        CTpc = NormalDistribution(parameters.CTpc.min, parameters.CTpc.max);
+        DDda = ExponentialDistribution(parameters.DDda.min, parameters.DDda.max);
+        DDwb = ExponentialDistribution(parameters.DDwb.min, parameters.DDwb.max);
+        DFda = ExponentialDistribution(parameters.DFda.min, parameters.DFda.max);
+        DFwb = ExponentialDistribution(parameters.DFwb.min, parameters.DFwb.max);
+        STda = ExponentialDistribution(parameters.STda.min, parameters.STda.max);
+        STwb = ExponentialDistribution(parameters.STwb.min, parameters.STwb.max);
+        this->parameters = parameters;
+    }
+
+    /**
+     * @brief Simulates one factory for @p Td seconds
+     *
+     * @param stream stream the factory belongs to
+     * @param factory index of the factory in the stream
+     * @param M number of machines on every station
+     * @param Td time factory is working [seconds]
+     * @param processed if not NULL, number of processed events is added to it
+     * @param timeline if not NULL, receives production, downtime and setups of every period
+     * @return number of semiconductors that passed pre-cap inspection until @p Td
+     */
+    long Simulate(uint32_t stream, uint32_t factory, int M, int Td, long *processed = NULL,
+                  const FactoryTimeline *timeline = NULL)
+    {
+        this->timeline = timeline;
+        this->Td = Td;
+        const int *Q = parameters.Q; // Batch size
+        for (int p = 0; p <= PARAMETER_COUNT; p++)
+            SeekFactory(engines[p], stream, factory, p);
+        QIndex.reset();
+
+        Qcur = Q[QIndex(engines[BATCH_SIZE_INDEX])];
+        produced = 0;
+        now = 0;
+        events.Clear();
+        for (int s = 0; s < STATION_COUNT; s++)
+        {
+            Machine idle = {false, false, 0};
+            machines[s].assign(M, idle);
+            queued[s] = 0;
+        }
+        for (int m = 0; m < M; m++)
+        {
+            events.Schedule(DFda(engines[DFDA]) * 60, FAILURE, DIE_ATTACH, m);
+            events.Schedule(DFwb(engines[DFWB]) * 60, FAILURE, WIRE_BOND, m);
+            TryStart(DIE_ATTACH, m);
+        }
+
+        long count = 0;
+        while (!events.Empty() && events.NextTime() <= Td)
+        {
+            EventQueue::Event event = events.Pop();
+            now = event.time;
+            count++;
+            Machine &machine = machines[event.station][event.machine];
+            switch (event.type)
+            {
+            case BATCH_DONE:
+                if (machine.delay > 0) // broke down during the batch
+                {
+                    events.Schedule(now + machine.delay, BATCH_DONE, event.station, event.machine);
+                    machine.delay = 0;
+                    break;
+                }
+                machine.busy = false;
+                if (event.station == PRE_CAP)
+                {
+                    produced += Qcur;
+                    if (timeline)
+                        timeline->produced[std::min((int)(now / timeline->period), (Td - 1) / timeline->period)] += Qcur;
+                }
+                else
+                {
+                    queued[event.station + 1]++;
+                    for (int m = 0; m < M; m++)
+                        TryStart(event.station + 1, m);
+                }
+                TryStart(event.station, event.machine);
+                break;
+            case FAILURE:
+            {
+                double duration = event.station == DIE_ATTACH ? DDda(engines[DDDA]) : DDwb(engines[DDWB]);
+                machine.down = true;
+                if (machine.busy)
+                    machine.delay += duration;
+                if (timeline)
+                    timeline->AddInterval(timeline->downtime, now, now + duration, Td);
+                events.Schedule(now + duration, REPAIR, event.station, event.machine);
+                break;
+            }
+            case REPAIR:
+            {
+                double frequency = event.station == DIE_ATTACH ? DFda(engines[DFDA]) : DFwb(engines[DFWB]);
+                machine.down = false;
+                events.Schedule(now + frequency * 60, FAILURE, event.station, event.machine);
+                TryStart(event.station, event.machine);
+                break;
+            }
+            }
+        }
+        if (processed)
+            *processed += count;
+        Count(EVENTS, count);
+        CTwb.FlushCount(); CTda.FlushCount(); CTpc.FlushCount();
+        DDda.FlushCount(); DDwb.FlushCount(); DFda.FlushCount(); DFwb.FlushCount();
+        STda.FlushCount(); STwb.FlushCount();
+        return produced;
+    }
+
+private:
+    enum Station { DIE_ATTACH, OVEN_CURE, WIRE_BOND, PRE_CAP, STATION_COUNT };
+    enum EventType { BATCH_DONE, FAILURE, REPAIR };
+
+    struct Machine
+    {
+        bool busy;
+        bool down;
+        double delay; // breakdown time that postpones the current batch
+    };
+
+    /**
+     * @brief Starts next batch on the machine if it is free and a batch is waiting
+     */
+    void TryStart(int station, int m)
+    {
+        Machine &machine = machines[station][m];
+        if (machine.busy || machine.down || (station != DIE_ATTACH && queued[station] == 0))
+            return;
+        if (station != DIE_ATTACH)
+            queued[station]--;
+
+        const int CToc = parameters.CToc; // Cycle Time Oven Cure
+        double duration = 0, setup = 0;
+        switch (station)
+        {
+        case DIE_ATTACH:
+            setup = STda(engines[STDA]);
+            duration = setup + Qcur * CTda(engines[CTDA]);
+            break;
+        case OVEN_CURE:
+            duration = CToc;
+            break;
+        case WIRE_BOND:
+            setup = STwb(engines[STWB]);
+            duration = setup + Qcur * CTwb(engines[CTWB]);
+            break;
+        case PRE_CAP:
+            duration = Qcur * CTpc(engines[CTPC]);
+            break;
+        }
+        if (timeline && setup > 0)
+            timeline->AddInterval(timeline->setup, now, now + setup, Td);
+        machine.busy = true;
+        events.Schedule(now + duration, BATCH_DONE, station, m);
+    }
+
+    RandomEngine engines[PARAMETER_COUNT + 1]; // one stream per parameter and Batch size
+    NormalDistribution CTwb, CTda, CTpc;
+    ExponentialDistribution DDda, DDwb, DFda, DFwb, STda, STwb;
+    std::uniform_int_distribution<int> QIndex;
+    ModelParameters parameters;
+
+    EventQueue events;
+    std::vector<Machine> machines[STATION_COUNT];
+    int queued[STATION_COUNT]; // batches waiting for the station
+    int Qcur;
+    long produced;
+    double now;
+    int Td;
+    const FactoryTimeline *timeline; // periods of the current factory, NULL when not recorded
+};
+
+/**
+ * @brief Long-lived state needed to simulate factories on one thread
+ *
+ * Owns the random engine, the input distributions and the batch buffers,
+ * so they are built once and reused by every simulated factory.
+ */
+class SimulationContext
+{
+public:
+    static const int BATCH_SIZE = 1024;
+
+    RandomEngine generator;
+    NormalDistribution CTwb;   // Cycle Time Wire Bond
+    NormalDistribution CTda;   // Cycle Time Die Attach
+    NormalDistribution CTpc;   // Cycle Time Pre-Cap Inspection
+    ExponentialDistribution DDda;  // Downtime Duration Die Attach
+    ExponentialDistribution DDwb;  // Downtime Duration Wire Bond
+    ExponentialDistribution DFda;  // Downtime Frequency Die Attach
+    ExponentialDistribution DFwb;  // Downtime Frequency Wire Bond
+    ExponentialDistribution STda;  // Setup Time Die Attach
+    ExponentialDistribution STwb;  // Setup Time Wire Bond
+    std::uniform_int_distribution<int> QIndex; // index of the Batch size
+    FactorySamples samples;
+    long Om[BATCH_SIZE];
+    ModelParameters parameters; // model the distributions were built for
+    LineSimulator line;
+    unsigned generation;        // value of the model generation counter when configured
+
+    explicit SimulationContext(const ModelParameters &parameters = ModelParameters()):
+        generator(simulationSeed),
+        CTwb(parameters.CTwb.min, parameters.CTwb.max), CTda(parameters.CTda.min, parameters.CTda.max),
+        CTpc(parameters.CTpc.min, parameters.CTpc.max), DDda(parameters.DDda.min, parameters.DDda.max),
+        DDwb(parameters.DDwb.min, parameters.DDwb.max), DFda(parameters.DFda.min, parameters.DFda.max),
+        DFwb(parameters.DFwb.min, parameters.DFwb.max), STda(parameters.STda.min, parameters.STda.max),
+        STwb(parameters.STwb.min, parameters.STwb.max),
+        QIndex(0, 2), samples(BATCH_SIZE), parameters(parameters), line(simulationSeed, parameters), generation(0)
+    {
+    }
+
+    /**
+     * @brief Rebuilds the distributions for another model, engines and buffers are kept
+     */
+    void Configure(const ModelParameters &parameters);
+
+    /**
+     * @brief Expected value of the input @p parameter, BATCH_SIZE_INDEX for the Batch size
+     */
+    double InputMean(int parameter) const;
+
+    /**
+     * @brief Adds the numbers drawn one by one from the distributions to the metrics
+     */
+    void FlushCounts()
+    {
+        CTwb.FlushCount(); CTda.FlushCount(); CTpc.FlushCount();
+        DDda.FlushCount(); DDwb.FlushCount(); DFda.FlushCount(); DFwb.FlushCount();
+        STda.FlushCount(); STwb.FlushCount();
+    }
+};
+
+SimulationContext *AcquireContext();
+void ReleaseContext(SimulationContext *context);
+
+/**
+ * @brief Regression model of the factory compiled for one policy and number of machines
+ *
+ * Every coefficient of @p Model is a compile-time constant, so each
+ * instance is a separate kernel with the coefficients folded in. Terms are
+ * added in the order of @p Model, negative coefficients give the same
+ * rounding as subtracting the term.
+ *
+ * @tparam Model policy with the regression of Tb, e.g. PaperModel
+ * @tparam MACHINES number of machines M, 0 takes it at runtime
+ */
+template <class Model, int MACHINES>
+struct FactoryModel
+{
+    /**
+     * @brief Tb of one factory before truncation, @p input(p) returns its Parameter p
+     */
+    template <class Input>
+    static double BatchTime(double CToc, Input input, double q)
+    {
+        double Tb = CToc;
+        for (int k = 0; k < Model::TERM_COUNT; k++)
+        {
+            const RegressionTerm &term = Model::TERMS[k];
+            Tb += term.coefficient * (input(term.input) - term.center) / term.scale;
+        }
+        return Tb + Model::BATCH_SIZE_COEFFICIENT * q;
+    }
+
+    /**
+     * @brief Evaluates Ttotal, Tb and Om of the sampled factories, see Factory::ComputeOutputs
+     */
+    static void ComputeOutputs(const FactorySamples &samples, int machines, int Td, double CToc, long *Om, int n)
+    {
+        Evaluate(samples, Constant(MACHINES > 0 ? MACHINES : machines), Constant(Td), CToc, Om, n);
+    }
+
+    /**
+     * @brief Evaluates Om of sampled factories that differ in number of machines and working time
+     *
+     * @param machines M of every factory
+     * @param Td working time of every factory [seconds]
+     */
+    static void ComputeOutputs(const FactorySamples &samples, const double *machines, const double *Td, double CToc,
+                               long *Om, int n)
+    {
+        Evaluate(samples, Column(machines), Column(Td), CToc, Om, n);
+    }
+
+private:
+    // attribute shared by the whole batch
+    struct Constant
+    {
+        explicit Constant(double value): value(value) {}
+        double operator [](int) const { return value; }
+#if defined(__AVX__)
+        __m256d Load(int) const { return _mm256_set1_pd(value); }
+#endif
+        double value;
+    };
+
+    // attribute of every factory of the batch
+    struct Column
+    {
+        explicit Column(const double *values): values(values) {}
+        double operator [](int i) const { return values[i]; }
+#if defined(__AVX__)
+        __m256d Load(int i) const { return _mm256_loadu_pd(values + i); }
+#endif
+        const double *values;
+    };
+
+    template <class Machines, class Time>
+    static void Evaluate(const FactorySamples &samples, Machines M, Time Td, double CToc, long *Om, int n)
+    {
+        const double *columns[PARAMETER_COUNT];
+        for (int p = 0; p < PARAMETER_COUNT; p++)
+            columns[p] = samples.values[p].data();
+        const double *ttStda = columns[TT_STDA];
+        const double *ttDdda = columns[TT_DDDA];
+        const double *ttStwb = columns[TT_STWB];
+        const double *ttDdwb = columns[TT_DDWB];
+        const double *q = samples.Q.data();
+        int i = 0;
+
+#if defined(__AVX__)
+        const int truncate = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+        const __m256d day = _mm256_set1_pd(86400);
+        double out[4];
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m256d td = Td.Load(i);
+            __m256d da = _mm256_mul_pd(_mm256_sub_pd(td, _mm256_loadu_pd(ttStda + i)),
+                _mm256_div_pd(_mm256_sub_pd(day, _mm256_loadu_pd(ttDdda + i)), day));
+            __m256d wb = _mm256_mul_pd(_mm256_sub_pd(td, _mm256_loadu_pd(ttStwb + i)),
+                _mm256_div_pd(_mm256_sub_pd(day, _mm256_loadu_pd(ttDdwb + i)), day));
+            __m256d ttotal = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(da, td), wb), td);
+            ttotal = _mm256_round_pd(_mm256_mul_pd(ttotal, M.Load(i)), truncate);
+
+            __m256d tb = _mm256_set1_pd(CToc);
+            for (int k = 0; k < Model::TERM_COUNT; k++)
+            {
+                const RegressionTerm &term = Model::TERMS[k];
+                __m256d x = _mm256_sub_pd(_mm256_loadu_pd(columns[term.input] + i), _mm256_set1_pd(term.center));
+                x = _mm256_mul_pd(_mm256_set1_pd(term.coefficient), x);
+                tb = _mm256_add_pd(tb, _mm256_div_pd(x, _mm256_set1_pd(term.scale)));
+            }
+            __m256d qv = _mm256_loadu_pd(q + i);
+            tb = _mm256_add_pd(tb, _mm256_mul_pd(_mm256_set1_pd(Model::BATCH_SIZE_COEFFICIENT), qv));
+            tb = _mm256_round_pd(tb, truncate);
+
+            _mm256_storeu_pd(out, _mm256_div_pd(_mm256_mul_pd(ttotal, qv), tb));
+            for (int k = 0; k < 4; k++)
+                Om[i + k] = (long)out[k];
+        }
+#endif
+        for (; i < n; i++)
+        {
+            double Ttotal = std::trunc(( (Td[i]-ttStda[i])*((86400-ttDdda[i])/86400) + Td[i] +(Td[i]-ttStwb[i])*((86400-ttDdwb[i])/86400)+Td[i] ) * M[i]);
+            double Tb = std::trunc(BatchTime(CToc, [&](int p) { return columns[p][i]; }, q[i]));
+            Om[i] = (long)(Ttotal * q[i] / Tb);
+        }
+    }
+};
+
+/**
+ * @brief Kernel evaluating Om of a batch of sampled factories, an instance of FactoryModel::ComputeOutputs
+ */
+typedef void (*OutputsKernel)(const FactorySamples &samples, int M, int Td, double CToc, long *Om, int n);
+
+/**
+ * @brief Picks the kernel compiled for @p M machines, or the one taking M at runtime
+ */
+OutputsKernel SelectOutputsKernel(int M);
+
+/**
+ * @brief Represents the semiconductors factory
+ * 
+ */
+class Factory
+{
+public:
+    
+    int M;  // Number of machines
+    int Td; // Time factory is working [seconds]
+    Factory(int m = 3, int td = 60*60*24)
+    {
+        M = m;
+        Td = td;
+    }
+
+    /**
+     * @brief Simulates the model factory
+     * 
+     * @param context engine and distributions owned by the calling thread
+     * @return number of semiconductors manufactured per @param Td
+     */
+    long SimulateTime(SimulationContext &context)
+    {
+        RandomEngine &generator = context.generator;
+        const int *Q = context.parameters.Q; // Batch size 
+        int Qcur = Q[0];
+
+        int CToc = context.parameters.CToc; // Cycle Time Oven Cure
+
+        Qcur = Q[context.QIndex(generator)];
+        double inputs[PARAMETER_COUNT]; // drawn in the order of the formulas
+        inputs[TT_STDA] = context.STda(generator);
+        inputs[TT_DDDA] = context.DDda(generator);
+        inputs[TT_STWB] = context.STwb(generator);
+        inputs[TT_DDWB] = context.DDwb(generator);
+        inputs[CTDA] = context.CTda(generator);
+        inputs[CTWB] = context.CTwb(generator);
+        inputs[CTPC] = context.CTpc(generator);
+        inputs[DDDA] = context.DDda(generator);
+        inputs[DDWB] = context.DDwb(generator);
+        inputs[DFDA] = context.DFda(generator);
+        inputs[DFWB] = context.DFwb(generator);
+        inputs[STDA] = context.STda(generator);
+        inputs[STWB] = context.STwb(generator);
+
+        long Ttotal= ( (Td-inputs[TT_STDA])*((86400-inputs[TT_DDDA])/86400) + Td +(Td-inputs[TT_STWB])*((86400-inputs[TT_DDWB])/86400)+Td ) * M ;
+        long Tb = FactoryModel<PaperModel, 0>::BatchTime(CToc, [&](int p) { return inputs[p]; }, Qcur);
+
+        long Om = Ttotal * Qcur / Tb;
+        Count(REGRESSION_FACTORIES);
+        context.FlushCounts();
+
+        return Om;
+    }
+
+    /**
+     * @brief Simulates @p n model factories at once
+     *
+     * Every input is drawn for the whole batch into the buffers of
+     * @p context first, then Ttotal, Tb and Om are evaluated over the arrays
+     * in a single pass. Nothing is allocated as long as @p n does not exceed
+     * SimulationContext::BATCH_SIZE.
+     *
+     * @param context engine, distributions and buffers owned by the calling thread
+     * @param stream stream the factories belong to
+     * @param first index of the first factory in the stream
+     * @param Om receives number of semiconductors manufactured per Td by every factory
+     * @param n number of factories
+     * @param antithetic odd factories mirror the random numbers of the previous even one
+     */
+    void SimulateBatch(SimulationContext &context, uint32_t stream, uint32_t first, long *Om, int n,
+                       bool antithetic = false)
+    {
+        SampleBatch(context, stream, first, n, antithetic);
+        ComputeOutputs(context.samples, context.parameters.CToc, Om, n);
+    }
+
+    /**
+     * @brief Draws inputs of factories @p first .. @p first + @p n - 1 of @p stream into context.samples
+     *
+     * Inputs do not depend on M or Td, so factories of any size share them.
+     */
+    static void SampleBatch(SimulationContext &context, uint32_t stream, uint32_t first, int n, bool antithetic = false)
+    {
+        const int *Q = context.parameters.Q; // Batch size
+        RandomEngine &generator = context.generator;
+        FactorySamples &samples = context.samples;
+
+        if (samples.Capacity() < n)
+            samples.Resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            SeekFactory(generator, stream, first + i, BATCH_SIZE_INDEX, antithetic);
+            context.QIndex.reset();
+            samples.Q[i] = Q[context.QIndex(generator)];
+        }
+        context.CTwb.Sample(generator, stream, first, CTWB, samples.values[CTWB].data(), n, antithetic);
+        context.CTda.Sample(generator, stream, first, CTDA, samples.values[CTDA].data(), n, antithetic);
+        context.CTpc.Sample(generator, stream, first, CTPC, samples.values[CTPC].data(), n, antithetic);
+        context.DDda.Sample(generator, stream, first, DDDA, samples.values[DDDA].data(), n, antithetic);
+        context.DDwb.Sample(generator, stream, first, DDWB, samples.values[DDWB].data(), n, antithetic);
+        context.DFda.Sample(generator, stream, first, DFDA, samples.values[DFDA].data(), n, antithetic);
+        context.DFwb.Sample(generator, stream, first, DFWB, samples.values[DFWB].data(), n, antithetic);
+        context.STda.Sample(generator, stream, first, STDA, samples.values[STDA].data(), n, antithetic);
+        context.STwb.Sample(generator, stream, first, STWB, samples.values[STWB].data(), n, antithetic);
+        context.STda.Sample(generator, stream, first, TT_STDA, samples.values[TT_STDA].data(), n, antithetic);
+        context.DDda.Sample(generator, stream, first, TT_DDDA, samples.values[TT_DDDA].data(), n, antithetic);
+        context.STwb.Sample(generator, stream, first, TT_STWB, samples.values[TT_STWB].data(), n, antithetic);
+        context.DDwb.Sample(generator, stream, first, TT_DDWB, samples.values[TT_DDWB].data(), n, antithetic);
+    }
+
+    /**
+     * @brief Evaluates Ttotal, Tb and Om of the sampled factories
+     *
+     * Both times are truncated to whole seconds as in SimulateTime. Ttotal * Q
+     * stays below 2^53, so the double division truncated to long gives the
+     * same result as the integer one.
+     *
+     * @param CToc Cycle Time Oven Cure
+     */
+    void ComputeOutputs(const FactorySamples &samples, double CToc, long *Om, int n) const
+    {
+        SelectOutputsKernel(M)(samples, M, Td, CToc, Om, n);
+    }
+
+    /**
+     * @brief Simulates the model factory event by event with LineSimulator
+     *
+     * @param context engine, distributions and buffers owned by the calling thread
+     * @param stream stream the factory belongs to
+     * @param index index of the factory in the stream
+     * @return number of semiconductors manufactured per Td
+     */
+    long SimulateEvents(SimulationContext &context, uint32_t stream, uint32_t index)
+    {
+        return context.line.Simulate(stream, index, M, Td);
+    }
+};
+
+/**
+ * @brief Way how production of a factory is computed
+ */
+enum Method
+{
+    REGRESSION,     // regression formula for Tb and Ttotal from the paper
+    DISCRETE_EVENT  // event by event simulation of the line
+};
+
+
+/**
+ * @brief Appends bytes of @p value to @p out
+ */
+template <class T>
+void SaveValue(std::vector<char> &out, const T &value)
+{
+    const char *bytes = (const char *)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+/**
+ * @brief Reads @p value saved by SaveValue and moves @p data past it
+ *
+ * @return false when fewer than sizeof(T) bytes are left before @p end
+ */
+template <class T>
+bool LoadValue(const char *&data, const char *end, T &value)
+{
+    if (end - data < (long)sizeof(T))
+        return false;
+    memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+/**
+ * @brief Mergeable sketch of a distribution answering quantile queries (t-digest)
+ *
+ * Values are kept as weighted centroids, small near both tails and large
+ * in the middle, so extreme quantiles stay precise while the memory is
+ * bounded by the compression. New values are buffered and merged into the
+ * centroids in sorted order once the buffer fills.
+ */
+class QuantileSketch
+{
+public:
+    explicit QuantileSketch(double compression = 100):
+        compression(compression), totalWeight(0)
+    {
+    }
+
+    void Add(double x, double weight = 1)
+    {
+        Centroid centroid = {x, weight};
+        buffer.push_back(centroid);
+        totalWeight += weight;
+        if (buffer.size() >= BufferLimit())
+            Compress();
+    }
+
+    void Merge(const QuantileSketch &other)
+    {
+        other.Compress();
+        for (size_t i = 0; i < other.centroids.size(); i++)
+            Add(other.centroids[i].mean, other.centroids[i].weight);
+    }
+
+    /**
+     * @brief Value below which fraction @p q of the added values lies
+     *
+     * Interpolates linearly between centers of the neighbouring centroids.
+     */
+    double Quantile(double q) const
+    {
+        Compress();
+        if (centroids.empty())
+            return NAN;
+        double target = q * totalWeight;
+        double cumulative = 0;
+        for (size_t i = 0; i < centroids.size(); i++)
+        {
+            double center = cumulative + centroids[i].weight / 2;
+            if (target < center)
+            {
+                if (i == 0)
+                    return centroids[0].mean;
+                double previous = cumulative - centroids[i - 1].weight / 2;
+                double fraction = (target - previous) / (center - previous);
+                return centroids[i - 1].mean + fraction * (centroids[i].mean - centroids[i - 1].mean);
+            }
+            cumulative += centroids[i].weight;
+        }
+        return centroids.back().mean;
+    }
+
+    /**
+     * @brief Appends the sketch to @p out in the byte order of the machine
+     */
+    void Save(std::vector<char> &out) const
+    {
+        Compress();
+        SaveValue(out, compression);
+        SaveValue(out, totalWeight);
+        SaveValue(out, (uint64_t)centroids.size());
+        for (size_t i = 0; i < centroids.size(); i++)
+            SaveValue(out, centroids[i]);
+    }
+
+    /**
+     * @brief Replaces the sketch by one saved by Save
+     *
+     * @return false when the data are truncated
+     */
+    bool Load(const char *&data, const char *end)
+    {
+        uint64_t size;
+        if (!LoadValue(data, end, compression) || !LoadValue(data, end, totalWeight) || !LoadValue(data, end, size)
+            || size > (uint64_t)(end - data) / sizeof(Centroid))
+            return false;
+        buffer.clear();
+        centroids.resize(size);
+        for (size_t i = 0; i < size; i++)
+            LoadValue(data, end, centroids[i]);
+        return true;
+    }
+
+private:
+    struct Centroid
+    {
+        double mean;
+        double weight;
+        bool operator <(const Centroid &other) const { return mean < other.mean; }
+    };
+
+    size_t BufferLimit() const
+    {
+        return 5 * compression;
+    }
+
+    // k1 scale function, centroids may span at most one unit of it
+    double Scale(double q) const
+    {
+        return compression / (2 * M_PI) * std::asin(2 * std::min(std::max(q, 0.0), 1.0) - 1);
+    }
+
+    void Compress() const
+    {
+        if (buffer.empty())
+            return;
+        buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+        std::sort(buffer.begin(), buffer.end());
+        centroids.clear();
+
+        Centroid current = buffer[0];
+        double before = 0; // weight of centroids left of current
+        for (size_t i = 1; i < buffer.size(); i++)
+        {
+            double after = before + current.weight + buffer[i].weight;
+            if (Scale(after / totalWeight) - Scale(before / totalWeight) <= 1)
+            {
+                double weight = current.weight + buffer[i].weight;
+                current.mean += (buffer[i].mean - current.mean) * buffer[i].weight / weight;
+                current.weight = weight;
+            }
+            else
+            {
+                centroids.push_back(current);
+                before += current.weight;
+                current = buffer[i];
+            }
+        }
+        centroids.push_back(current);
+        buffer.clear();
+    }
+
+    double compression;
+    double totalWeight;
+    mutable std::vector<Centroid> centroids; // compressed, sorted by mean
+    mutable std::vector<Centroid> buffer;    // added but not yet compressed
+};
+
+/**
+ * @brief Streaming statistics of a sequence of values in constant memory
+ *
+ * Mean and variance are updated by Welford's algorithm, quantiles come from
+ * QuantileSketch. Statistics gathered by different threads are combined by
+ * Merge. While all values are integers, as productions of factories are,
+ * their sum and sum of squares are also kept exactly in 128 bits and mean and
+ * variance are computed from them, so they do not depend on the order of
+ * Add and Merge calls.
+ */
+class RunningStatistics
+{
+public:
+    RunningStatistics():
+        n(0), mean(0), m2(0), min(INFINITY), max(-INFINITY), integral(true), sum(0), squares(0)
+    {
+    }
+
+    void Add(double x)
+    {
+        n++;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+        min = std::min(min, x);
+        max = std::max(max, x);
+        sketch.Add(x);
+        if (integral && x == std::floor(x) && std::fabs(x) < INTEGRAL_LIMIT)
+        {
+            sum += (long long)x;
+            squares += (Int128)(long long)x * (long long)x;
+        }
+        else
+        {
+            integral = false;
+        }
+    }
+
+    void Merge(const RunningStatistics &other)
+    {
+        if (other.n == 0)
+            return;
+        if (n == 0)
+        {
+            *this = other;
+            return;
+        }
+        long count = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta * other.n / count;
+        m2 += other.m2 + delta * delta * ((double)n * other.n / count);
+        n = count;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sketch.Merge(other.sketch);
+        integral = integral && other.integral;
+        sum += other.sum;
+        squares += other.squares;
+    }
+
+    long Count() const { return n; }
+    double Mean() const { return integral && n > 0 ? (double)sum / n : mean; }
+    double Min() const { return min; }
+    double Max() const { return max; }
+
+    /**
+     * @brief Exact sum of the values, valid only while all of them are integers
+     */
+    Int128 Sum() const { return sum; }
+    bool Integral() const { return integral; }
+
+    /**
+     * @brief Population variance, sum of squared deviations divided by the count
+     */
+    double Variance() const { return n > 0 ? SquaredDeviations() / n : 0; }
+
+    /**
+     * @brief Variance of the population estimated from the sample, divided by count - 1
+     */
+    double SampleVariance() const { return n > 1 ? SquaredDeviations() / (n - 1) : 0; }
+
+    double StandardDeviation() const { return std::sqrt(Variance()); }
+    double Quantile(double q) const { return sketch.Quantile(q); }
+
+    /**
+     * @brief Appends the statistics to @p out, other processes restore them by Load
+     */
+    void Save(std::vector<char> &out) const
+    {
+        SaveValue(out, (int64_t)n);
+        SaveValue(out, mean);
+        SaveValue(out, m2);
+        SaveValue(out, min);
+        SaveValue(out, max);
+        SaveValue(out, (uint8_t)integral);
+        SaveValue(out, sum);
+        SaveValue(out, squares);
+        sketch.Save(out);
+    }
+
+    /**
+     * @brief Replaces the statistics by ones saved by Save
+     *
+     * @return false when the data are truncated
+     */
+    bool Load(const char *&data, const char *end)
+    {
+        int64_t count;
+        uint8_t exact;
+        if (!LoadValue(data, end, count) || !LoadValue(data, end, mean) || !LoadValue(data, end, m2)
+            || !LoadValue(data, end, min) || !LoadValue(data, end, max) || !LoadValue(data, end, exact)
+            || !LoadValue(data, end, sum) || !LoadValue(data, end, squares))
+            return false;
+        n = count;
+        integral = exact != 0;
+        return sketch.Load(data, end);
+    }
+
+private:
+    // integers up to 2^40 keep the sum of squares of 10^14 values in 128 bits
+    static constexpr double INTEGRAL_LIMIT = 1099511627776.0;
+
+    /**
+     * @brief Sum of squared deviations from the mean
+     *
+     * For integers it is sum (x - a)^2 - b^2 / n, where a = sum / n and
+     * b = sum - n a are integers, so only the last two operations round.
+     */
+    double SquaredDeviations() const
+    {
+        if (!integral)
+            return m2;
+        Int128 a = sum / n;
+        Int128 b = sum - a * n;
+        Int128 deviations = squares - 2 * a * sum + a * a * n;
+        return (double)deviations - (double)b * (double)b / n;
+    }
+
+    long n;
+    double mean;
+    double m2; // sum of squared deviations from the mean
+    double min;
+    double max;
+    bool integral; // all values are integers below INTEGRAL_LIMIT
+    Int128 sum;
+    Int128 squares;
+    QuantileSketch sketch;
+};
+
+const unsigned MAX_WORKER_THREADS = 1024; // most threads of --threads
+extern unsigned workerThreads; // default number of worker threads, 0 means one per core
+unsigned WorkerCount(int count, unsigned threads);
+
+/**
+ * @brief Threads kept alive between parallel loops, started when a loop first needs them
+ *
+ * A search simulating thousands of small steps would otherwise start and
+ * join all threads for every step. The calling thread runs task 0 itself,
+ * so a loop of one worker never switches threads. Loops run one at a time,
+ * a task must not start another loop.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool();
+    ~WorkerPool();
+
+    /**
+     * @brief Calls task(t) for t = 0 .. @p threads - 1, each on its own thread, and waits for all of them
+     */
+    void Run(unsigned threads, const std::function<void(unsigned)> &task);
+
+private:
+    void Loop(unsigned index);
+
+    std::mutex runMutex; // held by the running loop
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> threads; // thread i runs task i + 1
+    const std::function<void(unsigned)> *task;
+    unsigned generation; // incremented by every loop
+    unsigned tasks;      // tasks of the running loop
+    unsigned remaining;  // tasks of pool threads not finished yet
+    bool stopping;
+};
+
+extern WorkerPool workerPool;
+
+/**
+ * @brief Splits @p count items evenly between @p threads workers of workerPool and waits for all of them
+ *
+ * @param work called as work(begin, end, t) on its own thread for the range of the t-th worker
+ */
+template <class Work>
+void RunWorkers(int count, unsigned threads, Work work)
+{
+    workerPool.Run(threads, [=, &work](unsigned t)
+    {
+        int begin = (long long)count * t / threads;
+        int end = (long long)count * (t + 1) / threads;
+        work(begin, end, t);
+    });
+}
+
+long SimulateFactories(int size, int count, int time, long *outputs, uint32_t stream, uint32_t first,
+                       Method method = REGRESSION, unsigned threads = 0);
+long GenerateFactories(int size, int count, int time, uint32_t stream = 0, unsigned threads = 0);
+const int MAX_NEEDED_FACTORIES = 1 << 30;   // largest answer of FactoriesNeeded, indices of the stream stay in uint32_t
+const int MAX_SEARCH_STEP = 1 << 20;        // factories simulated at once by FactoriesNeeded
+
+int FactoriesNeeded(int size, int time, long long target, uint32_t stream, long long *produced = NULL,
+                    RunningStatistics *statistics = NULL, uint32_t first = 0, std::vector<long> *outputs = NULL,
+                    Method method = REGRESSION, int limit = MAX_NEEDED_FACTORIES);
+
+/**
+ * @brief Factories that differ in size, start and operating hours, stored as structure of arrays
+ *
+ * Every attribute is kept in its own array, 7 bytes per factory, so a fleet
+ * of 10^6 factories takes 7 MB and is read sequentially batch by batch.
+ * Factory i of the fleet gets the random inputs of factory i of the stream,
+ * so adding factories does not change the ones already in the fleet.
+ */
+class FactoryFleet
+{
+public:
+    /**
+     * @brief Appends a factory
+     *
+     * @param machines number of machines M, 1 .. 65535
+     * @param start second of the horizon when the factory starts producing
+     * @param hours operating hours per day, 1 .. 24
+     * @return false when an attribute is out of range
+     */
+    bool Add(int machines, int start, int hours)
+    {
+        if (machines < 1 || machines > UINT16_MAX || start < 0 || hours < 1 || hours > 24)
+            return false;
+        this->machines.push_back(machines);
+        this->start.push_back(start);
+        this->hours.push_back(hours);
+        return true;
+    }
+
+    void Reserve(int count)
+    {
+        machines.reserve(count);
+        start.reserve(count);
+        hours.reserve(count);
+    }
+
+    void Clear()
+    {
+        machines.clear();
+        start.clear();
+        hours.clear();
+    }
+
+    int Size() const { return machines.size(); }
+    int Machines(int i) const { return machines[i]; }
+    int Start(int i) const { return start[i]; }
+    int Hours(int i) const { return hours[i]; }
+
+    /**
+     * @brief Seconds factory @p i works during the first @p horizon seconds, Td of its formula
+     */
+    int WorkingTime(int i, int horizon) const
+    {
+        return horizon > start[i] ? (long long)(horizon - start[i]) * hours[i] / 24 : 0;
+    }
+
+    /**
+     * @brief Bytes taken by the attributes of the factories
+     */
+    size_t MemoryUsage() const
+    {
+        return machines.capacity() * sizeof(uint16_t) + start.capacity() * sizeof(int32_t)
+            + hours.capacity() * sizeof(uint8_t);
+    }
+
+    /**
+     * @brief Simulates the fleet working for the first @p horizon seconds
+     *
+     * Factories are simulated in batches of SimulationContext::BATCH_SIZE on
+     * worker threads, a factory that has not started yet produces nothing.
+     *
+     * @param outputs if not NULL, receives production of every factory
+     * @param stream stream the factories are drawn from
+     * @param threads number of worker threads, 0 means workerThreads or one per core
+     * @return production of the whole fleet
+     */
+    long long Simulate(int horizon, long *outputs, uint32_t stream, Method method = REGRESSION,
+                       unsigned threads = 0) const;
+
+private:
+    std::vector<uint16_t> machines; // M of every factory
+    std::vector<int32_t> start;     // second the factory starts producing
+    std::vector<uint8_t> hours;     // operating hours per day
+};
+
+/**
+ * @brief Plans factories to build year after year so that production keeps up with a growing demand
+ *
+ * Factories built in earlier years stay in the fleet and keep producing.
+ * Production of a factory in a year does not change, so it is simulated
+ * once when the factory is built and cached; a year costs only the search
+ * for its new factories, which continue the indices of the fleet in its
+ * stream.
+ */
+class CapacityPlanner
+{
+public:
+    /**
+     * @param size size of every built factory (m)
+     * @param time length of a year [sec]
+     * @param stream stream the factories of the fleet are drawn from
+     * @param base yearly production outside of the fleet
+     */
+    CapacityPlanner(int size, int time, uint32_t stream, long long base):
+        size(size), time(time), stream(stream), capacity(base), years(0)
+    {
+    }
+
+    /**
+     * @brief Builds the factories needed for the next year to produce more than @p demand
+     *
+     * @param statistics if not NULL, production of every built factory is added to it
+     * @return number of factories built this year, -1 when FactoriesNeeded fails; then nothing is
+     *         built and the fleet, its outputs and @p statistics stay as they were
+     */
+    int Plan(long long demand, RunningStatistics *statistics = NULL);
+
+    /**
+     * @brief Yearly production of the base and the whole fleet
+     */
+    long long Capacity() const { return capacity; }
+
+    /**
+     * @brief Cached yearly production of factory @p i of the fleet
+     */
+    long Output(int i) const { return outputs[i]; }
+
+    const FactoryFleet &Fleet() const { return fleet; }
+
+private:
+    int size;
+    int time;
+    uint32_t stream;
+    long long capacity;
+    int years;                  // years planned so far
+    FactoryFleet fleet;         // built factories, started at the beginning of their year
+    std::vector<long> outputs;  // yearly production of every factory of the fleet
+};
+
+/**
+ * @brief Estimate of the mean production of one factory
+ */
+struct OutputEstimate
+{
+    double mean;                // estimated mean production of a factory per time
+    double standardError;       // standard error of the estimate
+    double plainStandardError;  // standard error of plain average of the same factories
+    long factories;             // number of simulated factories
+    RunningStatistics output;   // production of the simulated factories
+
+    /**
+     * @brief How many times more factories plain average would need for the same precision
+     */
+    double Reduction() const
+    {
+        return (plainStandardError * plainStandardError) / (standardError * standardError);
+    }
+};
+
+bool SolveLinearSystem(std::vector<std::vector<double> > &A, std::vector<double> &b, std::vector<double> &x);
+
+/**
+ * @brief Estimates mean production of one factory from a growing number of factories
+ *
+ * Add simulates only the factories following the ones already added and
+ * merges their sums with the earlier ones, so refining the estimate never
+ * repeats a factory. The variance reduction is chosen by the caller, it
+ * does not change any other simulation.
+ */
+class OutputEstimator
+{
+public:
+    /**
+     * @param size size of factory (m)
+     * @param time time, the factories will be working [sec]
+     * @param stream stream the factories are drawn from
+     * @param reduction variance reduction of the estimate
+     */
+    OutputEstimator(int size, int time, uint32_t stream, VarianceReduction reduction);
+
+    /**
+     * @brief Simulates the next @p count factories, rounded up to even
+     *
+     * @param threads number of worker threads, 0 means one per core
+     */
+    void Add(int count, unsigned threads = 0);
+
+    /**
+     * @brief Estimate from all factories added so far
+     */
+    OutputEstimate Estimate() const;
+
+private:
+    static const int K = PARAMETER_COUNT + 1; // controls: every sampled input and the Batch size
+
+    int size;
+    int time;
+    uint32_t stream;
+    VarianceReduction reduction;
+    long factories;
+    NeumaierSum y, yy, pair, pairpair;
+    NeumaierSum x[K], xx[K][K], xy[K];
+    RunningStatistics output;
+};
+
+#endif // SIMULATION_HPP
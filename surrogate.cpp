@@ -0,0 +1,190 @@
+/**
+ * @file surrogate.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Distribution of production of one factory answering questions about whole fleets
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <complex>
+#include "surrogate.hpp"
+
+typedef std::complex<double> Complex;
+
+const int MAX_LATTICE = 1 << 16;      // points of the convolved distribution, bins are merged for larger fleets
+const double NEGLIGIBLE = 1e-15;      // probability ending the sum of FactoriesNeeded
+
+/**
+ * @brief In-place radix-2 fast Fourier transform, @p data has a power of two elements
+ *
+ * @param inverse transform back, including the division by the size
+ */
+void Transform(std::vector<Complex> &data, bool inverse)
+{
+    size_t n = data.size();
+    for (size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+    std::vector<Complex> twiddles(n / 2);
+    for (size_t k = 0; k < n / 2; k++)
+        twiddles[k] = std::polar(1.0, (inverse ? 2 : -2) * M_PI * k / n);
+    for (size_t length = 2; length <= n; length <<= 1)
+    {
+        size_t stride = n / length;
+        for (size_t i = 0; i < n; i += length)
+        {
+            for (size_t k = 0; k < length / 2; k++)
+            {
+                Complex u = data[i + k];
+                Complex v = data[i + k + length / 2] * twiddles[k * stride];
+                data[i + k] = u + v;
+                data[i + k + length / 2] = u - v;
+            }
+        }
+    }
+    if (inverse)
+        for (size_t i = 0; i < n; i++)
+            data[i] /= (double)n;
+}
+
+/**
+ * @brief @p z to the power of @p n by squaring, exact for |z| = 1 unlike exp(n log z)
+ */
+Complex Power(Complex z, long n)
+{
+    Complex result = 1;
+    for (; n > 0; n >>= 1)
+    {
+        if (n & 1)
+            result *= z;
+        z *= z;
+    }
+    return result;
+}
+
+OutputSurrogate::OutputSurrogate():
+    min(0), max(0), width(1), mean(0), variance(0), skewness(0), samples(0)
+{
+}
+
+void OutputSurrogate::Build(int size, int time, long samples, uint32_t stream)
+{
+    ScopedTimer timer(SURROGATE);
+    this->samples = samples;
+    std::vector<long> outputs(samples);
+    SimulateFactories(size, samples, time, outputs.data(), stream, 0);
+
+    RunningStatistics statistics;
+    for (long i = 0; i < samples; i++)
+        statistics.Add(outputs[i]);
+    mean = statistics.Mean();
+    variance = statistics.Variance();
+    min = statistics.Min();
+    max = statistics.Max();
+    NeumaierSum cubes;
+    for (long i = 0; i < samples; i++)
+        cubes.Add(std::pow(outputs[i] - mean, 3));
+    skewness = variance > 0 ? cubes.Value() / samples / std::pow(variance, 1.5) : 0;
+
+    width = max > min ? (max - min) / BINS : 1;
+    probabilities.assign(BINS, 0);
+    for (long i = 0; i < samples; i++)
+        probabilities[std::min((int)((outputs[i] - min) / width), BINS - 1)] += 1.0 / samples;
+}
+
+double OutputSurrogate::FleetCdf(long n, double x) const
+{
+    if (x < n * min)
+        return 0;
+    if (x >= n * max)
+        return 1;
+
+    if (n > FFT_FACTORIES)
+    {
+        double sd = std::sqrt(n * variance);
+        double z = (x - n * mean) / sd;
+        double density = std::exp(-z * z / 2) / std::sqrt(2 * M_PI);
+        double p = 0.5 * std::erfc(-z / std::sqrt(2.0)) - density * skewness * (z * z - 1) / (6 * std::sqrt((double)n));
+        return std::min(std::max(p, 0.0), 1.0);
+    }
+
+    // bins are merged by powers of two until the sum of n of them fits the lattice
+    int merged = 1;
+    while (n * (BINS / merged - 1) + 1 > MAX_LATTICE)
+        merged *= 2;
+    int bins = BINS / merged;
+    long points = n * (bins - 1) + 1;
+    size_t size = 1;
+    while ((long)size < points)
+        size *= 2;
+
+    std::vector<Complex> lattice(size, 0.0);
+    double centers = 0; // mean of the merged histogram taken at the centers of its bins
+    for (int b = 0; b < BINS; b++)
+        lattice[b / merged] += probabilities[b];
+    double step = width * merged;
+    for (int b = 0; b < bins; b++)
+        centers += lattice[b].real() * (min + (b + 0.5) * step);
+
+    Transform(lattice, false);
+    for (size_t k = 0; k < size; k++)
+        lattice[k] = Power(lattice[k], n);
+    Transform(lattice, true);
+
+    // sum point k is n factories manufacturing n * min + (k + n / 2) * step, shifted so its mean is n * mean
+    double lowest = n * (min + 0.5 * step + mean - centers) - 0.5 * step;
+    double position = (x - lowest) / step;
+    if (position <= 0)
+        return 0;
+    if (position >= points)
+        return 1;
+    long last = (long)position;
+    NeumaierSum p;
+    for (long k = 0; k < last; k++)
+        p.Add(std::max(lattice[k].real(), 0.0));
+    p.Add((position - last) * std::max(lattice[last].real(), 0.0));
+    return std::min(p.Value(), 1.0);
+}
+
+double OutputSurrogate::FactoriesNeeded(double target) const
+{
+    if (max <= 0)
+        return HUGE_VAL;
+    // n factories never exceed target while n * max <= target
+    long certain = (long)std::floor(target / max);
+    NeumaierSum sum;
+    sum.Add(certain + 1);
+    for (long n = certain + 1; n * min <= target; n++)
+    {
+        double p = FleetCdf(n, target);
+        sum.Add(p);
+        if (n * mean > target && p < NEGLIGIBLE)
+            break;
+    }
+    return sum.Value();
+}
+
+long OutputSurrogate::FleetSize(double target, double probability) const
+{
+    if (max <= 0)
+        return -1;
+    long low = (long)std::floor(target / max); // exceeds the target with probability 0
+    long high = low + 1;
+    while (1 - FleetCdf(high, target) < probability)
+        high *= 2;
+    while (high - low > 1)
+    {
+        long middle = low + (high - low) / 2;
+        if (1 - FleetCdf(middle, target) < probability)
+            low = middle;
+        else
+            high = middle;
+    }
+    return high;
+}
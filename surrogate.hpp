@@ -0,0 +1,75 @@
+/**
+ * @file surrogate.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Distribution of production of one factory answering questions about whole fleets
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SURROGATE_HPP
+#define SURROGATE_HPP
+
+#include "simulation.hpp"
+
+/**
+ * @brief Histogram of Om of one factory configuration, a surrogate of simulating every factory of a fleet
+ *
+ * Factories of a fleet are independent and identically distributed, so the
+ * production of n of them is the n-fold convolution of the distribution of
+ * one. The distribution is simulated once from a large sample; fleets of
+ * up to FFT_FACTORIES factories are convolved by FFT, larger ones use the
+ * central limit theorem with Edgeworth's skewness correction, whose error
+ * falls with the square root of the fleet size.
+ */
+class OutputSurrogate
+{
+public:
+    static const int FFT_FACTORIES = 256; // largest fleet convolved exactly
+    static const int BINS = 4096;
+
+    OutputSurrogate();
+
+    /**
+     * @brief Simulates @p samples factories of @p size machines working @p time seconds and keeps their histogram
+     *
+     * @param stream stream the factories are drawn from
+     */
+    void Build(int size, int time, long samples, uint32_t stream);
+
+    double Mean() const { return mean; }
+    double StandardDeviation() const { return std::sqrt(variance); }
+    double Skewness() const { return skewness; }
+    long Samples() const { return samples; }
+
+    /**
+     * @brief Probability that @p n factories manufacture at most @p x together
+     */
+    double FleetCdf(long n, double x) const;
+
+    /**
+     * @brief Expected number of factories added one by one until they manufacture more than @p target
+     *
+     * Same quantity as the mean of FactoriesNeeded over runs, computed as
+     * the sum of P(n factories manufacture at most @p target) over n.
+     */
+    double FactoriesNeeded(double target) const;
+
+    /**
+     * @brief Smallest fleet that manufactures more than @p target with probability at least @p probability
+     *
+     * @return -1 when no factory of the sample manufactures anything
+     */
+    long FleetSize(double target, double probability) const;
+
+private:
+    double min;         // smallest Om of the sample, lower edge of the first bin
+    double max;         // largest Om of the sample
+    double width;       // width of a bin
+    double mean;        // mean of the sample
+    double variance;    // variance of the sample
+    double skewness;    // skewness of the sample
+    long samples;
+    std::vector<double> probabilities; // fraction of the sample in every bin
+};
+
+#endif // SURROGATE_HPP
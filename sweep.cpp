@@ -0,0 +1,315 @@
+/**
+ * @file sweep.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Evaluation of many scenarios of the model read from a file in one run
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <fstream>
+#include "sweep.hpp"
+#include "shard.hpp"
+
+using std::cout;
+using std::endl;
+
+const uint32_t SWEEP_STREAM = 5u << 24; // common stream of the scenarios
+
+Scenario::Scenario():
+    M(3), Td(365*24*60*60), factories(10000), method(REGRESSION), stream(SWEEP_STREAM)
+{
+}
+
+/**
+ * @brief Result of one scenario as written by --binary
+ *
+ * The file starts with the 8 bytes "IMSSWEEP", uint32 version and uint32
+ * size of the record, followed by one record per scenario in the order of
+ * the scenario file. All values are in the byte order of the machine.
+ */
+struct SweepRecord
+{
+    uint32_t index;     // position of the scenario in the file
+    uint32_t factories;
+    int64_t total;      // production of all factories
+    double mean;        // production of one factory
+    double standardDeviation;
+    double min;
+    double max;
+    double p50;
+    double p95;
+    double p99;
+    double seconds;     // time spent simulating the scenario
+};
+
+const uint32_t SWEEP_VERSION = 1;
+
+std::string Trim(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+/**
+ * @brief Parses exactly @p count comma separated numbers of @p text into @p numbers
+ */
+bool ParseNumbers(const std::string &text, double *numbers, int count)
+{
+    const char *position = text.c_str();
+    for (int i = 0; i < count; i++)
+    {
+        char *end;
+        numbers[i] = strtod(position, &end);
+        if (end == position)
+            return false;
+        while (*end == ' ' || *end == '\t')
+            end++;
+        if (i + 1 < count)
+        {
+            if (*end != ',')
+                return false;
+            end++;
+        }
+        position = end;
+    }
+    return *position == '\0';
+}
+
+ScenarioReader::ScenarioReader(std::istream &input):
+    input(input), pending(false), line(0)
+{
+}
+
+bool ScenarioReader::Fail(const std::string &message)
+{
+    error = "line " + std::to_string(line) + ": " + message;
+    return false;
+}
+
+bool ScenarioReader::Set(Scenario &scenario, const std::string &key, const std::string &value)
+{
+    ModelParameters &parameters = scenario.parameters;
+    Bounds *bounds[] = {&parameters.CTwb, &parameters.CTda, &parameters.CTpc, &parameters.DDda, &parameters.DDwb,
+                        &parameters.DFda, &parameters.DFwb, &parameters.STda, &parameters.STwb};
+    const char *names[] = {"CTwb", "CTda", "CTpc", "DDda", "DDwb", "DFda", "DFwb", "STda", "STwb"};
+    for (int i = 0; i < 9; i++)
+    {
+        if (key != names[i])
+            continue;
+        double numbers[2];
+        if (!ParseNumbers(value, numbers, 2) || numbers[0] < 0 || numbers[0] >= numbers[1])
+            return Fail(key + " has to be \"min, max\" with 0 <= min < max");
+        bounds[i]->min = numbers[0];
+        bounds[i]->max = numbers[1];
+        return true;
+    }
+
+    if (key == "Q")
+    {
+        double numbers[3];
+        if (!ParseNumbers(value, numbers, 3))
+            return Fail("Q has to be three batch sizes");
+        for (int i = 0; i < 3; i++)
+            if (numbers[i] < 1 || numbers[i] > MAX_BATCH_SIZE || numbers[i] != std::floor(numbers[i]))
+                return Fail("Q has to be three whole batch sizes between 1 and " + std::to_string(MAX_BATCH_SIZE));
+        for (int i = 0; i < 3; i++)
+            parameters.Q[i] = numbers[i];
+        return true;
+    }
+    if (key == "method")
+    {
+        if (value == "regression")
+            scenario.method = REGRESSION;
+        else if (value == "events")
+            scenario.method = DISCRETE_EVENT;
+        else
+            return Fail("method has to be regression or events");
+        return true;
+    }
+
+    double number;
+    if (!ParseNumbers(value, &number, 1))
+        return Fail(key + " has to be a number");
+    bool whole = number == std::floor(number); // all of them are stored as integers
+    if (key == "CToc" && whole && number > 0 && number <= INT32_MAX)
+        parameters.CToc = number;
+    else if (key == "M" && whole && number >= 1 && number <= MAX_MACHINES)
+        scenario.M = number;
+    else if (key == "Td" && whole && number >= 1 && number <= INT32_MAX)
+        scenario.Td = number;
+    else if (key == "factories" && whole && number >= 1 && number <= INT32_MAX)
+        scenario.factories = number;
+    else if (key == "stream" && whole && number >= 0 && number <= UINT32_MAX)
+        scenario.stream = number;
+    else if (key == "CToc" || key == "M" || key == "Td" || key == "factories" || key == "stream")
+        return Fail(key + " is out of range or not a whole number");
+    else
+        return Fail("unknown key " + key);
+    return true;
+}
+
+bool ScenarioReader::Next(Scenario &scenario)
+{
+    error.clear();
+    bool started = pending;
+    if (pending)
+    {
+        scenario = defaults;
+        scenario.name = pendingName;
+        pending = false;
+    }
+
+    std::string text;
+    while (std::getline(input, text))
+    {
+        line++;
+        text = Trim(text.substr(0, text.find_first_of("#;")));
+        if (text.empty())
+            continue;
+        if (text[0] == '[')
+        {
+            if (text[text.size() - 1] != ']')
+                return Fail("missing ] of the scenario name");
+            std::string name = Trim(text.substr(1, text.size() - 2));
+            if (started)
+            {
+                pendingName = name;
+                pending = true;
+                return true;
+            }
+            scenario = defaults;
+            scenario.name = name;
+            started = true;
+            continue;
+        }
+
+        size_t equals = text.find('=');
+        if (equals == std::string::npos)
+            return Fail("expected key = value or [name]");
+        std::string key = Trim(text.substr(0, equals));
+        std::string value = Trim(text.substr(equals + 1));
+        if (!Set(started ? scenario : defaults, key, value))
+            return false;
+    }
+    if (input.bad())
+        return Fail("read error");
+    return started;
+}
+
+/**
+ * @brief Writes results of the scenarios in the order they finish
+ */
+class SweepWriter
+{
+public:
+    SweepWriter(std::ostream &output, bool binary):
+        output(output), binary(binary)
+    {
+        if (binary)
+        {
+            uint32_t header[2] = {SWEEP_VERSION, sizeof(SweepRecord)};
+            output.write("IMSSWEEP", 8);
+            output.write((const char *)header, sizeof(header));
+        }
+        else
+        {
+            output << "index,name,method,M,Td,factories,total,mean,sd,min,max,p50,p95,p99,seconds" << endl;
+        }
+    }
+
+    void Write(const Scenario &scenario, const SweepRecord &record)
+    {
+        if (binary)
+        {
+            output.write((const char *)&record, sizeof(record));
+            output.flush();
+            return;
+        }
+        std::string name = scenario.name;
+        for (size_t i = 0; i < name.size(); i++)
+            if (name[i] == ',' || name[i] == '"')
+                name[i] = ' ';
+        output << record.index << "," << name << "," << (scenario.method == DISCRETE_EVENT ? "events" : "regression")
+               << "," << scenario.M << "," << scenario.Td << "," << record.factories << "," << record.total
+               << "," << record.mean << "," << record.standardDeviation << "," << record.min << "," << record.max
+               << "," << record.p50 << "," << record.p95 << "," << record.p99 << "," << record.seconds << endl;
+    }
+
+private:
+    std::ostream &output;
+    bool binary;
+};
+
+bool RunSweep(const char *path, const char *output, bool binary, Coordinator *coordinator)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        cout << "Cannot read scenarios from " << path << endl;
+        return false;
+    }
+    std::ofstream file;
+    if (output)
+    {
+        file.open(output, binary ? std::ios::out | std::ios::binary : std::ios::out);
+        if (!file)
+        {
+            cout << "Cannot write results to " << output << endl;
+            return false;
+        }
+    }
+    std::ostream &stream = output ? file : cout;
+    stream.precision(10);
+    SweepWriter writer(stream, binary);
+
+    ModelParameters previous = modelParameters;
+    ScenarioReader reader(input);
+    Scenario scenario;
+    uint32_t index = 0;
+    bool ok = true;
+    while (reader.Next(scenario))
+    {
+        myclock::time_point start = myclock::now();
+        ShardJob job = {scenario.parameters, scenario.M, scenario.Td, scenario.stream, scenario.factories, scenario.method};
+        ShardResult result;
+        if (!coordinator)
+        {
+            SimulateShard(job, 0, job.count, result);
+        }
+        else if (!coordinator->Run(job, result))
+        {
+            ok = false;
+            break;
+        }
+        const RunningStatistics &statistics = result.statistics;
+        SweepRecord record;
+        record.index = index++;
+        record.factories = scenario.factories;
+        record.total = result.total;
+        record.mean = statistics.Mean();
+        record.standardDeviation = statistics.StandardDeviation();
+        record.min = statistics.Min();
+        record.max = statistics.Max();
+        record.p50 = statistics.Quantile(0.5);
+        record.p95 = statistics.Quantile(0.95);
+        record.p99 = statistics.Quantile(0.99);
+        record.seconds = std::chrono::duration<double>(myclock::now() - start).count();
+        writer.Write(scenario, record);
+        if (!stream)
+        {
+            cout << "Cannot write results" << endl;
+            ok = false;
+            break;
+        }
+    }
+    if (ok && !reader.Error().empty())
+    {
+        cout << path << ": " << reader.Error() << endl;
+        ok = false;
+    }
+    SetModelParameters(previous);
+    return ok;
+}
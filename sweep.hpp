@@ -0,0 +1,89 @@
+/**
+ * @file sweep.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Evaluation of many scenarios of the model read from a file in one run
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <istream>
+#include <string>
+#include "simulation.hpp"
+
+class Coordinator;
+
+const int MAX_MACHINES = 1024;        // largest M of a scenario, the event simulation keeps every machine
+const int MAX_BATCH_SIZE = 1 << 20;   // largest batch size of Q, about 100 times the paper's largest
+
+/**
+ * @brief One what-if of the model and how many factories evaluate it
+ */
+struct Scenario
+{
+    std::string name;
+    ModelParameters parameters;
+    int M;              // Number of machines
+    int Td;             // Time factory is working [seconds]
+    int factories;      // number of simulated factories
+    Method method;
+    uint32_t stream;    // stream the factories are drawn from
+
+    Scenario();
+};
+
+/**
+ * @brief Reads scenarios one by one from an INI-like file
+ *
+ * Every "[name]" line starts a scenario, "key = value" lines before the
+ * first one set defaults of all scenarios, lines after it change only that
+ * scenario. Keys are the model inputs CTwb, CTda, CTpc, DDda, DDwb, DFda,
+ * DFwb, STda, STwb ("min, max"), Q ("q1, q2, q3") and CToc, and the run
+ * settings M, Td, factories, method (regression or events) and stream.
+ * All of them but the input distributions have to be whole numbers.
+ * Text after '#' or ';' is a comment.
+ */
+class ScenarioReader
+{
+public:
+    explicit ScenarioReader(std::istream &input);
+
+    /**
+     * @brief Reads the next scenario
+     *
+     * @return false at the end of the file or on error, Error() tells which
+     */
+    bool Next(Scenario &scenario);
+
+    const std::string &Error() const { return error; }
+
+private:
+    bool Set(Scenario &scenario, const std::string &key, const std::string &value);
+    bool Fail(const std::string &message);
+
+    std::istream &input;
+    Scenario defaults;
+    std::string pendingName; // name of the scenario whose header was already read
+    bool pending;
+    int line;
+    std::string error;
+};
+
+/**
+ * @brief Simulates every scenario of @p path and streams a result row as soon as it finishes
+ *
+ * Scenarios share the worker contexts, only their distributions are
+ * rebuilt between scenarios. By default all of them use the same stream,
+ * so their differences are not hidden by different random numbers.
+ *
+ * @param path scenario file
+ * @param output file for the results, NULL for stdout
+ * @param binary write fixed-size binary records instead of CSV
+ * @param coordinator if not NULL, scenarios are simulated by its worker processes
+ * @return false when a file cannot be read or written, a scenario is invalid or its shards fail
+ */
+bool RunSweep(const char *path, const char *output, bool binary, Coordinator *coordinator = NULL);
+
+#endif // SWEEP_HPP
@@ -0,0 +1,313 @@
+/**
+ * @file tests.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Checks of the random numbers, the searches and the reductions, run by make test
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <string>
+#include "experiments.hpp"
+#include "sensitivity.hpp"
+
+using std::cout;
+using std::endl;
+
+int failures = 0;
+
+/**
+ * @brief Prints the result of one check and counts the failed ones
+ */
+void Check(bool passed, const std::string &name)
+{
+    cout << name << (passed ? "\tOK" : "\tFAILED") << endl;
+    failures += !passed;
+}
+
+/**
+ * @brief Philox4x32-10 against the known answers of Random123, and the AVX2 path against the scalar one
+ */
+void TestPhilox()
+{
+    const uint32_t counters[3][4] = {{0, 0, 0, 0}, {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                                     {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+    const uint32_t keys[3][2] = {{0, 0}, {0xffffffff, 0xffffffff}, {0xa4093822, 0x299f31d0}};
+    const uint32_t answers[3][4] = {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+                                    {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+                                    {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+    for (int i = 0; i < 3; i++)
+    {
+        uint32_t block[4];
+        PhiloxEngine::Block(counters[i], keys[i], block);
+        Check(std::equal(block, block + 4, answers[i]), "Philox known answer " + std::to_string(i));
+    }
+
+    // the seed is the key, the first output joins the first two words of the block of counter 0
+    PhiloxEngine engine(0xa4093822299f31d0ULL);
+    SeekFactory(engine, 0x03707344, 0x13198a2e, 0x85a308d3);
+    uint32_t block[4];
+    const uint32_t counter[4] = {0, 0x85a308d3, 0x13198a2e, 0x03707344}, key[2] = {0x299f31d0, 0xa4093822};
+    PhiloxEngine::Block(counter, key, block);
+    Check(engine() == (((uint64_t)block[1] << 32) | block[0]), "Philox engine uses the seed as key");
+
+    const int n = 1000;
+    const uint32_t first = UINT32_MAX - n / 2; // crosses the wrap of the factory index
+    std::vector<double> batch(n);
+    int wrong = 0;
+    for (int antithetic = 0; antithetic < 2; antithetic++)
+    {
+        PhiloxEngine seeded(12345);
+        seeded.Uniforms(42, first, 7, antithetic, batch.data(), n);
+        for (int i = 0; i < n; i++)
+        {
+            SeekFactory(seeded, 42, first + i, 7, antithetic);
+            wrong += batch[i] != UniformNumber(seeded);
+        }
+    }
+    Check(wrong == 0, "Philox batches equal single factories");
+}
+
+/**
+ * @brief FactoriesNeeded against the prefix sums of the same factories simulated one by one
+ *
+ * Targets equal to a prefix sum need one factory more, as the fleet has to
+ * exceed them, and the ends of the galloping steps are the likeliest places
+ * for an error by one.
+ */
+void TestFactoriesNeeded()
+{
+    const int COUNT = 5000;
+    const int YEAR = 365*24*60*60;
+    const uint32_t stream = 9u << 24;
+    std::vector<long> outputs(COUNT);
+    SimulateFactories(3, COUNT, YEAR, outputs.data(), stream, 0);
+    std::vector<long long> prefix(COUNT + 1, 0);
+    for (int i = 0; i < COUNT; i++)
+        prefix[i + 1] = prefix[i] + outputs[i];
+
+    int wrong = 0;
+    const int counts[] = {1, 2, 63, 64, 65, 192, 193, 1000, 4000};
+    for (int count : counts)
+        for (int shift = -1; shift <= 0; shift++)
+        {
+            long long target = prefix[count] + shift; // the fleet of count factories just exceeds or just meets it
+            long long produced = 0;
+            std::vector<long> fleet;
+            int needed = FactoriesNeeded(3, YEAR, target, stream, &produced, NULL, 0, &fleet);
+            int expected = shift < 0 ? count : count + 1;
+            wrong += needed != expected || produced != prefix[expected] || fleet.size() != (size_t)expected
+                   || !std::equal(fleet.begin(), fleet.end(), outputs.begin());
+        }
+    Check(wrong == 0, "FactoriesNeeded finds the smallest fleet exceeding the target");
+}
+
+/**
+ * @brief Statistics merged from parts, in another order and through Save and Load, against one pass
+ *
+ * Integer values keep exact sums, so count, mean, variance and extremes
+ * have to be equal to the last bit; the merged quantile sketch only has to
+ * stay close to the exact ranks.
+ */
+void TestRunningStatistics()
+{
+    const int COUNT = 100000;
+    const int PARTS = 7;
+    PhiloxEngine engine(3);
+    std::vector<double> values(COUNT);
+    for (double &x : values)
+        x = (double)(engine() >> 24); // integers below 2^40, their squares need more than 64 bits
+    RunningStatistics single;
+    for (double x : values)
+        single.Add(x);
+
+    RunningStatistics merged;
+    for (int part = PARTS - 1; part >= 0; part--)
+    {
+        RunningStatistics statistics;
+        for (int i = part * COUNT / PARTS; i < (part + 1) * COUNT / PARTS; i++)
+            statistics.Add(values[i]);
+        std::vector<char> bytes;
+        statistics.Save(bytes);
+        const char *data = bytes.data();
+        RunningStatistics loaded;
+        loaded.Load(data, data + bytes.size());
+        merged.Merge(loaded);
+    }
+    Check(merged.Count() == single.Count() && merged.Sum() == single.Sum() && merged.Mean() == single.Mean()
+          && merged.Variance() == single.Variance() && merged.Min() == single.Min() && merged.Max() == single.Max(),
+          "RunningStatistics merged in parts equal one pass");
+
+    std::sort(values.begin(), values.end());
+    double worst = 0; // largest distance between the requested and the true rank of a quantile
+    const double levels[] = {0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99};
+    for (double q : levels)
+    {
+        double rank = (double)(std::lower_bound(values.begin(), values.end(), merged.Quantile(q)) - values.begin()) / COUNT;
+        worst = std::max(worst, std::fabs(rank - q));
+    }
+    Check(worst < 0.005, "QuantileSketch merged in parts within 0.5 % of the ranks");
+}
+
+/**
+ * @brief Totals, estimates and indices of 1 thread against other numbers of threads, to the last bit
+ */
+void TestThreadInvariance()
+{
+    const int COUNT = 10000;
+    const int YEAR = 365*24*60*60;
+    const uint32_t stream = 10u << 24;
+    const unsigned threads[] = {2, 3, 7};
+
+    std::vector<long> reference(COUNT), outputs(COUNT);
+    long total = SimulateFactories(3, COUNT, YEAR, reference.data(), stream, 0, REGRESSION, 1);
+    int wrong = 0;
+    for (unsigned t : threads)
+        wrong += SimulateFactories(3, COUNT, YEAR, outputs.data(), stream, 0, REGRESSION, t) != total
+               || outputs != reference;
+    Check(wrong == 0, "SimulateFactories does not depend on the number of threads");
+
+    wrong = 0;
+    const VarianceReduction reductions[] = {NO_REDUCTION, ANTITHETIC, CONTROL_VARIATES};
+    for (VarianceReduction reduction : reductions)
+    {
+        OutputEstimator single(3, YEAR, stream, reduction);
+        single.Add(COUNT, 1);
+        OutputEstimate expected = single.Estimate();
+        for (unsigned t : threads)
+        {
+            OutputEstimator parallel(3, YEAR, stream, reduction);
+            parallel.Add(COUNT, t);
+            OutputEstimate estimate = parallel.Estimate();
+            wrong += estimate.mean != expected.mean || estimate.standardError != expected.standardError
+                   || estimate.plainStandardError != expected.plainStandardError;
+        }
+    }
+    Check(wrong == 0, "OutputEstimator does not depend on the number of threads");
+
+    std::vector<SensitivityIndices> one, many;
+    EstimateSensitivity(3, YEAR, 2048, one, 1);
+    EstimateSensitivity(3, YEAR, 2048, many, 3);
+    wrong = one.size() != many.size();
+    for (size_t c = 0; !wrong && c < one.size(); c++)
+    {
+        wrong += one[c].mean != many[c].mean || one[c].variance != many[c].variance;
+        for (int f = 0; f < SensitivityIndices::FACTOR_COUNT; f++)
+            wrong += one[c].first[f] != many[c].first[f] || one[c].total[f] != many[c].total[f];
+    }
+    Check(wrong == 0, "EstimateSensitivity does not depend on the number of threads");
+}
+
+/**
+ * @brief Sums of 128 bits past the range of 64, checked by merging a statistics with itself
+ *
+ * Doubling 40 times multiplies the sums by 2^40 and leaves mean and
+ * variance unchanged to the last bit, as every rounding is scaled by a
+ * power of two.
+ */
+void TestInt128()
+{
+    Check(ToString((Int128)1 << 100) == "1267650600228229401496703205376" && ToString(-(Int128)12345) == "-12345",
+          "Int128 is printed in decimal");
+
+    RunningStatistics base;
+    PhiloxEngine engine(5);
+    for (int i = 0; i < 1000; i++)
+        base.Add((double)(engine() >> 24));
+    RunningStatistics doubled = base;
+    for (int i = 0; i < 40; i++)
+    {
+        RunningStatistics copy = doubled;
+        doubled.Merge(copy);
+    }
+    Check(doubled.Sum() == base.Sum() * ((Int128)1 << 40) && doubled.Sum() > (Int128)UINT64_MAX
+          && doubled.Count() == base.Count() << 40 && doubled.Mean() == base.Mean()
+          && doubled.Variance() == base.Variance(),
+          "RunningStatistics sums stay exact past 64 bits");
+}
+
+/**
+ * @brief Kolmogorov-Smirnov distance between @p samples truncated to 3 digits and the distribution function @p cdf
+ *
+ * A sample v stands for the values v .. v + 0.001 it was truncated from, so
+ * the share of samples below v is compared with cdf(v) and the share up to
+ * v with cdf(v + 0.001).
+ */
+template <class Cdf>
+double KolmogorovDistance(std::vector<double> samples, Cdf cdf)
+{
+    std::sort(samples.begin(), samples.end());
+    double n = samples.size(), distance = 0;
+    for (size_t i = 0, j = 0; i < samples.size(); i = j)
+    {
+        while (j < samples.size() && samples[j] == samples[i])
+            j++;
+        distance = std::max(distance, std::max(std::fabs(i / n - cdf(samples[i])),
+                                               std::fabs(j / n - cdf(samples[i] + 0.001))));
+    }
+    return distance;
+}
+
+/**
+ * @brief Samples of the quantile tables against the exact truncated distributions, and batches against single numbers
+ *
+ * The critical value of the Kolmogorov-Smirnov test at level 0.001 is
+ * 1.95 / sqrt(n); the samples are fixed by the seed, so the test does not
+ * fail at random.
+ */
+void TestDistributions()
+{
+    const int COUNT = 1 << 17;
+    const double CRITICAL = 1.95 / std::sqrt((double)COUNT);
+    const uint32_t stream = 11u << 24;
+    RandomEngine generator(simulationSeed);
+    std::vector<double> samples(COUNT);
+
+    const double low = 6.2, high = 6.35; // window of the normal distribution, mean +- 2 sd
+    NormalDistribution normal(low, high);
+    normal.Sample(generator, stream, 0, CTWB, samples.data(), COUNT);
+    double mean = (low + high) / 2, sd = (high - low) / 4;
+    auto phi = [=](double x) { return 0.5 * std::erfc((mean - x) / (sd * M_SQRT2)); };
+    double normalDistance = KolmogorovDistance(samples, [=](double x)
+    {
+        return std::min(1.0, std::max(0.0, (phi(x) - phi(low)) / (phi(high) - phi(low))));
+    });
+    int wrong = 0;
+    for (int i = 0; i < COUNT; i += 97)
+    {
+        SeekFactory(generator, stream, i, CTWB);
+        wrong += normal(generator) != samples[i];
+    }
+
+    const double from = 1000, to = 5000; // window of the exponential distribution, 95 % of it below to
+    ExponentialDistribution exponential(from, to);
+    exponential.Sample(generator, stream, 0, DDDA, samples.data(), COUNT);
+    double lambda = -std::log(0.05) / (to - from);
+    double exponentialDistance = KolmogorovDistance(samples, [=](double x)
+    {
+        double cdf = -std::expm1(-lambda * (x - from)) / -std::expm1(-lambda * (to - from));
+        return std::min(1.0, std::max(0.0, cdf));
+    });
+    for (int i = 0; i < COUNT; i += 97)
+    {
+        SeekFactory(generator, stream, i, DDDA);
+        wrong += exponential(generator) != samples[i];
+    }
+
+    cout << "Kolmogorov-Smirnov distance normal: " << normalDistance << "\texponential: " << exponentialDistance
+         << "\tcritical: " << CRITICAL << endl;
+    Check(normalDistance < CRITICAL && exponentialDistance < CRITICAL, "Quantile tables pass the Kolmogorov-Smirnov test");
+    Check(wrong == 0, "Batches of the distributions equal single numbers");
+}
+
+int main()
+{
+    simulationSeed = 1;
+    TestPhilox();
+    TestFactoriesNeeded();
+    TestRunningStatistics();
+    TestThreadInvariance();
+    TestInt128();
+    TestDistributions();
+    cout << (failures ? std::to_string(failures) + " checks failed" : "All checks passed") << endl;
+    return failures ? 1 : 0;
+}
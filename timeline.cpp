@@ -0,0 +1,207 @@
+/**
+ * @file timeline.cpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Production, downtime and setups of every factory per day, streamed to a columnar file
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "timeline.hpp"
+
+using std::cout;
+using std::endl;
+
+const char TIMELINE_MAGIC[8] = {'I', 'M', 'S', 'T', 'I', 'M', 'E', 'L'};
+const uint32_t TIMELINE_STREAM = 7u << 24;
+
+bool TimelineWriter::Open(const char *path, const TimelineHeader &header)
+{
+    this->header = header;
+    this->header.factories = 0;
+    file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC));
+    file.write((const char *)&this->header, sizeof(this->header));
+    return (bool)file;
+}
+
+bool TimelineWriter::Write(const uint32_t *produced, const float *downtime, const float *setup, uint32_t n)
+{
+    size_t values = (size_t)n * header.periods;
+    file.write((const char *)produced, values * sizeof(uint32_t));
+    file.write((const char *)downtime, values * sizeof(float));
+    file.write((const char *)setup, values * sizeof(float));
+    header.factories += n;
+    return (bool)file;
+}
+
+bool TimelineWriter::Close()
+{
+    file.seekp(sizeof(TIMELINE_MAGIC));
+    file.write((const char *)&header, sizeof(header));
+    file.close();
+    return !file.fail();
+}
+
+TimelineReader::TimelineReader():
+    data(NULL), size(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+TimelineReader::~TimelineReader()
+{
+    if (data)
+        munmap((void *)data, size);
+}
+
+bool TimelineReader::Open(const char *path)
+{
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0)
+    {
+        error = std::string("cannot open ") + path + ": " + strerror(errno);
+        if (descriptor >= 0)
+            close(descriptor);
+        return false;
+    }
+    size = status.st_size;
+    if (size < sizeof(TIMELINE_MAGIC) + sizeof(TimelineHeader))
+    {
+        close(descriptor);
+        error = std::string(path) + " is not a timeline file";
+        return false;
+    }
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor); // the mapping keeps the file
+    if (mapped == MAP_FAILED)
+    {
+        error = std::string("cannot map ") + path + ": " + strerror(errno);
+        return false;
+    }
+    data = (const char *)mapped;
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    memcpy(&header, data + sizeof(TIMELINE_MAGIC), sizeof(header));
+    uint64_t expected = sizeof(TIMELINE_MAGIC) + sizeof(header)
+                      + header.factories * header.periods * 3 * sizeof(uint32_t);
+    if (memcmp(data, TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC)) != 0 || header.version != TIMELINE_VERSION)
+        error = std::string(path) + " is not a timeline file of version " + std::to_string(TIMELINE_VERSION);
+    else if (header.periods == 0 || header.blockFactories == 0 || size != expected)
+        error = std::string(path) + " is truncated or was not closed";
+    return error.empty();
+}
+
+const char *TimelineReader::Column(uint64_t i, int column) const
+{
+    uint64_t block = i / header.blockFactories;
+    uint64_t first = block * header.blockFactories;
+    uint64_t n = std::min<uint64_t>(header.blockFactories, header.factories - first);
+    size_t factoryBytes = header.periods * sizeof(uint32_t);
+    const char *start = data + sizeof(TIMELINE_MAGIC) + sizeof(header) + first * 3 * factoryBytes;
+    return start + (column * n + (i - first)) * factoryBytes;
+}
+
+bool RunTimeline(long count, const char *path, int period, int M, int Td)
+{
+    ScopedTimer timer(TIMELINE);
+    TimelineHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = TIMELINE_VERSION;
+    header.period = period;
+    header.periods = ((long long)Td + period - 1) / period;
+    size_t factoryBytes = (size_t)header.periods * 3 * sizeof(uint32_t);
+    header.blockFactories = std::max<size_t>(1, std::min<size_t>(TIMELINE_BLOCK, TIMELINE_BUFFER / factoryBytes));
+    header.M = M;
+    header.Td = Td;
+    header.stream = TIMELINE_STREAM;
+
+    TimelineWriter writer;
+    if (!writer.Open(path, header))
+    {
+        cout << "Cannot write timeline to " << path << endl;
+        return false;
+    }
+    size_t values = (size_t)header.blockFactories * header.periods;
+    std::vector<uint32_t> produced(values);
+    std::vector<float> downtime(values), setup(values);
+    long long total = 0;
+    myclock::time_point start = myclock::now();
+    for (long first = 0; first < count; first += header.blockFactories)
+    {
+        int n = std::min<long>(header.blockFactories, count - first);
+        std::fill(produced.begin(), produced.end(), 0);
+        std::fill(downtime.begin(), downtime.end(), 0);
+        std::fill(setup.begin(), setup.end(), 0);
+        Count(EVENT_FACTORIES, n);
+        RunWorkers(n, WorkerCount(n, 0), [&](int begin, int end, unsigned)
+        {
+            SimulationContext *context = AcquireContext();
+            for (int k = begin; k < end; k++)
+            {
+                size_t offset = (size_t)k * header.periods;
+                FactoryTimeline timeline = {period, &produced[offset], &downtime[offset], &setup[offset]};
+                context->line.Simulate(TIMELINE_STREAM, first + k, M, Td, NULL, &timeline);
+            }
+            ReleaseContext(context);
+        });
+        for (size_t v = 0; v < (size_t)n * header.periods; v++)
+            total += produced[v];
+        if (!writer.Write(produced.data(), downtime.data(), setup.data(), n))
+        {
+            cout << "Cannot write timeline to " << path << endl;
+            return false;
+        }
+    }
+    if (!writer.Close())
+    {
+        cout << "Cannot write timeline to " << path << endl;
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(myclock::now() - start).count();
+    cout << "Factories: " << count << "\tperiods: " << header.periods << " of " << period << " s\tproduction: " << total
+         << "\tfactories/s: " << count / seconds << endl;
+    return true;
+}
+
+bool ScanTimeline(const char *path)
+{
+    TimelineReader reader;
+    if (!reader.Open(path))
+    {
+        cout << reader.Error() << endl;
+        return false;
+    }
+    const TimelineHeader &header = reader.Header();
+    std::vector<long long> produced(header.periods, 0);
+    std::vector<double> downtime(header.periods, 0), setup(header.periods, 0);
+    for (uint64_t i = 0; i < reader.Factories(); i++)
+    {
+        const uint32_t *p = reader.Produced(i);
+        const float *d = reader.Downtime(i);
+        const float *s = reader.Setup(i);
+        for (uint32_t t = 0; t < header.periods; t++)
+        {
+            produced[t] += p[t];
+            downtime[t] += d[t];
+            setup[t] += s[t];
+        }
+    }
+
+    uint32_t lowest = 0;
+    cout << "period,start,produced,downtime,setup" << endl;
+    for (uint32_t t = 0; t < header.periods; t++)
+    {
+        cout << t << "," << (long long)t * header.period << "," << produced[t] << "," << downtime[t] << "," << setup[t] << endl;
+        if (produced[t] < produced[lowest] && (t + 1) * (long long)header.period <= header.Td)
+            lowest = t;
+    }
+    std::cerr << "Factories: " << reader.Factories() << ", lowest production in period " << lowest << ": "
+              << produced[lowest] << std::endl;
+    return true;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file timeline.hpp
+ * @author Rebeka Cernianska (xcerni13), Peter Rucek (xrucek00)
+ * @brief Production, downtime and setups of every factory per day, streamed to a columnar file
+ * @date 2021-12-08
+ * @copyright Copyright (c) 2021
+ */
+
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include <fstream>
+#include <string>
+#include "simulation.hpp"
+
+/**
+ * @brief Header of a timeline file, after the 8 bytes "IMSTIMEL"
+ *
+ * Factories follow in blocks of blockFactories (the last one may be
+ * shorter). A block of n factories holds three columns one after another:
+ * uint32 produced, float downtime and float setup, each of them n * periods
+ * values, the periods of one factory next to each other. Every block but
+ * the last has the same size, so factory i is found without an index. All
+ * values are in the byte order of the machine.
+ */
+struct TimelineHeader
+{
+    uint32_t version;
+    uint32_t period;            // length of a period [seconds]
+    uint32_t periods;           // periods of every factory, ceil(Td / period)
+    uint32_t blockFactories;    // factories of a full block
+    uint64_t factories;         // factories in the file, written when the file is closed
+    int32_t M;                  // machines on every station
+    int32_t Td;                 // simulated time [seconds]
+    uint32_t stream;            // stream of the factories, factory i of the file is factory i of it
+    uint32_t reserved;
+};
+
+const uint32_t TIMELINE_VERSION = 1;
+const uint32_t TIMELINE_BLOCK = 256;   // most factories of a block of --timeline
+const size_t TIMELINE_BUFFER = 1 << 28; // bytes of a block, fewer factories when their periods would not fit
+
+/**
+ * @brief Writes blocks of a timeline file as they are simulated
+ */
+class TimelineWriter
+{
+public:
+    /**
+     * @return false when the file cannot be created
+     */
+    bool Open(const char *path, const TimelineHeader &header);
+
+    /**
+     * @brief Appends a block of @p n factories, columns of n * periods values
+     */
+    bool Write(const uint32_t *produced, const float *downtime, const float *setup, uint32_t n);
+
+    /**
+     * @brief Writes the number of factories to the header and closes the file
+     */
+    bool Close();
+
+private:
+    std::ofstream file;
+    TimelineHeader header;
+};
+
+/**
+ * @brief Memory-mapped timeline file, pages are read by the kernel as factories are scanned
+ */
+class TimelineReader
+{
+public:
+    TimelineReader();
+    ~TimelineReader();
+
+    /**
+     * @return false when the file cannot be mapped or is not a complete timeline file, see Error
+     */
+    bool Open(const char *path);
+
+    const TimelineHeader &Header() const { return header; }
+    uint64_t Factories() const { return header.factories; }
+
+    /**
+     * @brief Production of factory @p i in its periods
+     */
+    const uint32_t *Produced(uint64_t i) const { return (const uint32_t *)Column(i, 0); }
+
+    /**
+     * @brief Seconds of breakdowns of factory @p i in its periods
+     */
+    const float *Downtime(uint64_t i) const { return (const float *)Column(i, 1); }
+
+    /**
+     * @brief Seconds of setups of factory @p i in its periods
+     */
+    const float *Setup(uint64_t i) const { return (const float *)Column(i, 2); }
+
+    const std::string &Error() const { return error; }
+
+private:
+    const char *Column(uint64_t i, int column) const;
+
+    const char *data;
+    size_t size;
+    TimelineHeader header;
+    std::string error;
+};
+
+const int TIMELINE_TIME = 365*24*60*60; // year of --timeline, its horizon without --years [seconds]
+const int MIN_TIMELINE_PERIOD = 60;     // shortest period of --period [seconds]
+
+/**
+ * @brief Simulates @p count factories event by event for @p Td seconds and streams their periods to @p path
+ *
+ * Blocks of factories are simulated on all cores and written as soon as
+ * they finish, so memory does not grow with @p count.
+ *
+ * @param period length of a period [seconds], MIN_TIMELINE_PERIOD .. @p Td
+ * @param M machines on every station
+ */
+bool RunTimeline(long count, const char *path, int period, int M, int Td);
+
+/**
+ * @brief Prints production, downtime and setups of the whole fleet of @p path in every period as CSV
+ */
+bool ScanTimeline(const char *path);
+
+#endif // TIMELINE_HPP